@@ -0,0 +1,102 @@
+/*! \file analysis.c
+ *  \brief Level and band analysis of the choir voices, used for mouth animation.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "analysis.h"
+#include "seqlock.h"
+#include <libsuperderpy.h>
+
+static const float band_edges[ANALYSIS_BANDS - 1] = {300.0, 1000.0, 3000.0};
+
+void InitAnalysis(struct Analysis* analysis, unsigned int frequency) {
+	memset(analysis, 0, sizeof(struct Analysis));
+	for (int i = 0; i < ANALYSIS_BANDS - 1; i++) {
+		analysis->coeffs[i] = 1.0 - exp(-2.0 * ALLEGRO_PI * band_edges[i] / frequency);
+	}
+	analysis->coeffs[ANALYSIS_BANDS - 1] = 1.0; // last lane just follows the input
+}
+
+void AnalyzeBlock(struct Analysis* analysis, const float* buffer, unsigned int frames) {
+	double start = al_get_time();
+
+	if (frames > ANALYSIS_MAX_FRAMES) {
+		// keep the cost bounded with large buffers; the most recent part is what's about to be heard
+		buffer += (frames - ANALYSIS_MAX_FRAMES) * 2;
+		frames = ANALYSIS_MAX_FRAMES;
+	}
+
+	// Level of both channels, two stereo frames per vector.
+	v4sf squares = v4sf_set1(0.0);
+	unsigned int i = 0;
+	for (; i + 2 <= frames; i += 2) {
+		v4sf v = v4sf_load(buffer + i * 2);
+		squares += v * v;
+	}
+	float sum = v4sf_sum(squares);
+	for (; i < frames; i++) {
+		sum += buffer[i * 2] * buffer[i * 2] + buffer[i * 2 + 1] * buffer[i * 2 + 1];
+	}
+
+	// Band split: every lane runs a lowpass at the next band edge over the mid signal,
+	// and the bands are the differences between neighbouring lanes.
+	v4sf coeffs = analysis->coeffs, state = analysis->state;
+	v4sf energy = v4sf_set1(0.0);
+	for (i = 0; i < frames; i++) {
+		float mid = (buffer[i * 2] + buffer[i * 2 + 1]) * 0.5;
+		state += coeffs * (v4sf_set1(mid) - state);
+		v4sf lower = {0.0, state[0], state[1], state[2]};
+		v4sf band = state - lower;
+		energy += band * band;
+	}
+	analysis->state = state;
+
+	if (frames) {
+		analysis->rms = sqrtf(sum / (frames * 2));
+		for (int b = 0; b < ANALYSIS_BANDS; b++) {
+			analysis->bands[b] = energy[b] / frames;
+		}
+	}
+
+	double cost = al_get_time() - start;
+	analysis->cost_total += cost;
+	if (cost > analysis->cost_max) {
+		analysis->cost_max = cost;
+	}
+	analysis->blocks++;
+}
+
+void PublishAnalysis(struct AnalysisChannel* channel, struct Analysis* analysis, uint64_t position) {
+	BeginSeqlockWrite(&channel->sequence);
+
+	channel->snapshot.rms = analysis->rms;
+	memcpy(channel->snapshot.bands, analysis->bands, sizeof(analysis->bands));
+	channel->snapshot.position = position;
+	channel->snapshot.time = al_get_time();
+
+	EndSeqlockWrite(&channel->sequence);
+}
+
+void ReadAnalysis(struct AnalysisChannel* channel, struct AnalysisSnapshot* snapshot) {
+	unsigned int before;
+	do {
+		before = BeginSeqlockRead(&channel->sequence);
+		memcpy(snapshot, &channel->snapshot, sizeof(struct AnalysisSnapshot));
+	} while (RetrySeqlockRead(&channel->sequence, before));
+}
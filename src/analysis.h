@@ -0,0 +1,70 @@
+/*! \file analysis.h
+ *  \brief Level and band analysis of the choir voices, used for mouth animation.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_ANALYSIS_H
+#define POTATOES_ANALYSIS_H
+
+#include "simd.h"
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define ANALYSIS_BANDS 4
+#define ANALYSIS_MAX_FRAMES 1024 // upper bound of frames analyzed per block, regardless of the buffer size
+
+/*! \brief Running analysis of a stereo float32 signal.
+ *
+ * Each block yields its RMS level and the mean energies of four bands
+ * (below ~300 Hz, ~300-1000 Hz, ~1-3 kHz and above ~3 kHz). All values are
+ * normalized by the number of frames, so they don't depend on the buffer size.
+ */
+struct Analysis {
+	v4sf coeffs, state; // one-pole lowpasses at the band edges, one per lane
+	float rms;
+	float bands[ANALYSIS_BANDS];
+
+	// cost of AnalyzeBlock on the audio thread, in seconds
+	double cost_total, cost_max;
+	unsigned int blocks;
+};
+
+/*! \brief Analysis results of a single block, as seen by the renderer. */
+struct AnalysisSnapshot {
+	float rms;
+	float bands[ANALYSIS_BANDS];
+	uint64_t position; // transport frame at which the analyzed block starts
+	double time; // al_get_time() at which the block was analyzed
+};
+
+/*! \brief Single-writer, single-reader seqlock carrying snapshots from the audio thread.
+ *
+ * The writer never waits. The reader retries while a write is in progress,
+ * which is short and happens at most once per audio buffer.
+ */
+struct AnalysisChannel {
+	atomic_uint sequence;
+	struct AnalysisSnapshot snapshot;
+};
+
+void InitAnalysis(struct Analysis* analysis, unsigned int frequency);
+void AnalyzeBlock(struct Analysis* analysis, const float* buffer, unsigned int frames);
+void PublishAnalysis(struct AnalysisChannel* channel, struct Analysis* analysis, uint64_t position);
+void ReadAnalysis(struct AnalysisChannel* channel, struct AnalysisSnapshot* snapshot);
+
+#endif
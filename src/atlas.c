@@ -0,0 +1,201 @@
+/*! \file atlas.c
+ *  \brief Packs small bitmaps into shared texture pages.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "atlas.h"
+#include <libsuperderpy.h>
+
+struct AtlasEntry {
+	ALLEGRO_BITMAP* source;
+	ALLEGRO_BITMAP* bitmap; // sub-bitmap of one of the pages; NULL if it didn't fit
+	int page, x, y;
+};
+
+struct Atlas {
+	struct AtlasEntry* entries;
+	int count, allocated;
+	ALLEGRO_BITMAP** pages;
+	int page_count;
+	int size;
+};
+
+struct Atlas* CreateAtlas(void) {
+	return calloc(1, sizeof(struct Atlas));
+}
+
+void AddAtlasBitmap(struct Atlas* atlas, ALLEGRO_BITMAP* bitmap) {
+	for (int i = 0; i < atlas->count; i++) {
+		if (atlas->entries[i].source == bitmap) {
+			return;
+		}
+	}
+	if (atlas->count == atlas->allocated) {
+		atlas->allocated = atlas->allocated ? atlas->allocated * 2 : 16;
+		atlas->entries = realloc(atlas->entries, sizeof(struct AtlasEntry) * atlas->allocated);
+	}
+	atlas->entries[atlas->count++] = (struct AtlasEntry){.source = bitmap, .page = -1};
+}
+
+static int CompareEntries(const void* a, const void* b) {
+	const struct AtlasEntry *x = a, *y = b;
+	return al_get_bitmap_height(y->source) - al_get_bitmap_height(x->source);
+}
+
+static void Pack(struct Atlas* atlas) {
+	// Simple shelf packing: tallest entries first, left to right, opening a new shelf
+	// (and then a new page) when the current one gets full.
+	qsort(atlas->entries, atlas->count, sizeof(struct AtlasEntry), CompareEntries);
+
+	int page = 0, x = 0, y = 0, shelf = 0;
+	for (int i = 0; i < atlas->count; i++) {
+		struct AtlasEntry* entry = &atlas->entries[i];
+		int w = al_get_bitmap_width(entry->source) + ATLAS_PADDING * 2;
+		int h = al_get_bitmap_height(entry->source) + ATLAS_PADDING * 2;
+		if (w > atlas->size || h > atlas->size) {
+			continue; // drawn from its own texture
+		}
+		if (x + w > atlas->size) {
+			x = 0;
+			y += shelf;
+			shelf = 0;
+		}
+		if (y + h > atlas->size) {
+			page++;
+			x = 0;
+			y = 0;
+			shelf = 0;
+		}
+		entry->page = page;
+		entry->x = x + ATLAS_PADDING;
+		entry->y = y + ATLAS_PADDING;
+		x += w;
+		if (h > shelf) {
+			shelf = h;
+		}
+		atlas->page_count = page + 1;
+	}
+}
+
+void BuildAtlas(struct Atlas* atlas) {
+	atlas->size = al_get_display_option(al_get_current_display(), ALLEGRO_MAX_BITMAP_SIZE);
+	if (atlas->size <= 0 || atlas->size > ATLAS_MAX_SIZE) {
+		atlas->size = ATLAS_MAX_SIZE;
+	}
+
+	Pack(atlas);
+
+	// Pages only get as tall as the shelves on them.
+	int* heights = calloc(atlas->page_count, sizeof(int));
+	for (int i = 0; i < atlas->count; i++) {
+		struct AtlasEntry* entry = &atlas->entries[i];
+		if (entry->page >= 0) {
+			int bottom = entry->y + al_get_bitmap_height(entry->source) + ATLAS_PADDING;
+			if (bottom > heights[entry->page]) {
+				heights[entry->page] = bottom;
+			}
+		}
+	}
+
+	ALLEGRO_BITMAP* target = al_get_target_bitmap();
+	ALLEGRO_TRANSFORM identity;
+	al_identity_transform(&identity);
+
+	// Mipmap levels would average neighbouring entries into each other once the 1px padding
+	// gets halved away, so pages are only filtered linearly.
+	int flags = al_get_new_bitmap_flags();
+	al_set_new_bitmap_flags((flags & ~ALLEGRO_MIPMAP) | ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR);
+
+	atlas->pages = calloc(atlas->page_count, sizeof(ALLEGRO_BITMAP*));
+	for (int p = 0; p < atlas->page_count; p++) {
+		atlas->pages[p] = al_create_bitmap(atlas->size, heights[p]);
+		al_set_target_bitmap(atlas->pages[p]);
+		al_use_transform(&identity);
+		al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+		for (int i = 0; i < atlas->count; i++) {
+			struct AtlasEntry* entry = &atlas->entries[i];
+			if (entry->page == p) {
+				al_draw_bitmap(entry->source, entry->x, entry->y, 0);
+				entry->bitmap = al_create_sub_bitmap(atlas->pages[p], entry->x, entry->y,
+					al_get_bitmap_width(entry->source), al_get_bitmap_height(entry->source));
+			}
+		}
+	}
+	al_set_target_bitmap(target);
+	al_set_new_bitmap_flags(flags);
+	free(heights);
+}
+
+ALLEGRO_BITMAP* GetAtlasBitmap(struct Atlas* atlas, ALLEGRO_BITMAP* bitmap) {
+	for (int i = 0; i < atlas->count; i++) {
+		if (atlas->entries[i].source == bitmap) {
+			return atlas->entries[i].bitmap ? atlas->entries[i].bitmap : bitmap;
+		}
+	}
+	return bitmap;
+}
+
+int GetAtlasPageCount(struct Atlas* atlas) {
+	return atlas->page_count;
+}
+
+void DestroyAtlas(struct Atlas* atlas) {
+	for (int i = 0; i < atlas->count; i++) {
+		if (atlas->entries[i].bitmap) {
+			al_destroy_bitmap(atlas->entries[i].bitmap);
+		}
+	}
+	for (int p = 0; p < atlas->page_count; p++) {
+		al_destroy_bitmap(atlas->pages[p]);
+	}
+	free(atlas->pages);
+	free(atlas->entries);
+	free(atlas);
+}
+
+ALLEGRO_BITMAP* CreateScaledBitmap(ALLEGRO_BITMAP* bitmap, float scale) {
+	// Sprites that are always drawn much smaller than their source can be shrunk once, so they take
+	// less of the atlas and don't get minified on every draw. Halving with linear filtering is
+	// a 2x2 box filter, so it's repeated while more than a halving is left; that way every source
+	// pixel counts, unlike with a single linear draw at the final scale.
+	int flags = al_get_new_bitmap_flags();
+	al_set_new_bitmap_flags((flags & ~ALLEGRO_MIPMAP) | ALLEGRO_MIN_LINEAR | ALLEGRO_MAG_LINEAR);
+	ALLEGRO_BITMAP* target = al_get_target_bitmap();
+	ALLEGRO_TRANSFORM identity;
+	al_identity_transform(&identity);
+
+	ALLEGRO_BITMAP* result = al_clone_bitmap(bitmap);
+	while (scale < 1.0) {
+		float step = scale < 0.5 ? 0.5 : scale;
+		int w = al_get_bitmap_width(result), h = al_get_bitmap_height(result);
+		int width = fmax(1, round(w * step)), height = fmax(1, round(h * step));
+		ALLEGRO_BITMAP* next = al_create_bitmap(width, height);
+		al_set_target_bitmap(next);
+		al_use_transform(&identity);
+		al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+		al_draw_scaled_bitmap(result, 0, 0, w, h, 0, 0, width, height, 0);
+		al_destroy_bitmap(result);
+		result = next;
+		scale /= step;
+	}
+
+	al_set_target_bitmap(target);
+	al_set_new_bitmap_flags(flags);
+	return result;
+}
@@ -0,0 +1,39 @@
+/*! \file atlas.h
+ *  \brief Packs small bitmaps into shared texture pages.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_ATLAS_H
+#define POTATOES_ATLAS_H
+
+#include <allegro5/allegro.h>
+
+#define ATLAS_MAX_SIZE 4096
+#define ATLAS_PADDING 1 // transparent border around every entry, so linear filtering doesn't bleed
+
+struct Atlas;
+
+struct Atlas* CreateAtlas(void);
+void AddAtlasBitmap(struct Atlas* atlas, ALLEGRO_BITMAP* bitmap);
+void BuildAtlas(struct Atlas* atlas);
+ALLEGRO_BITMAP* GetAtlasBitmap(struct Atlas* atlas, ALLEGRO_BITMAP* bitmap);
+int GetAtlasPageCount(struct Atlas* atlas);
+void DestroyAtlas(struct Atlas* atlas);
+ALLEGRO_BITMAP* CreateScaledBitmap(ALLEGRO_BITMAP* bitmap, float scale);
+
+#endif
@@ -0,0 +1,135 @@
+/*! \file benchmark.c
+ *  \brief Scripted frame time benchmark.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "benchmark.h"
+#include <libsuperderpy.h>
+
+struct Benchmark* CreateBenchmark(int frames) {
+	struct Benchmark* benchmark = calloc(1, sizeof(struct Benchmark));
+	benchmark->frames = frames;
+	benchmark->singing = -1;
+	return benchmark;
+}
+
+void DestroyBenchmark(struct Benchmark* benchmark) {
+	free(benchmark->draw);
+	free(benchmark->logic);
+	free(benchmark);
+}
+
+static int CompareTimes(const void* a, const void* b) {
+	double x = *(const double*)a, y = *(const double*)b;
+	return (x > y) - (x < y);
+}
+
+static double Percentile(const double* sorted, int count, double p) {
+	return sorted[(int)(p * (count - 1) + 0.5)] * 1000.0;
+}
+
+static void ReportTimes(const char* name, double* times, int count) {
+	qsort(times, count, sizeof(double), CompareTimes);
+	printf(" %s p50 %.2f p95 %.2f p99 %.2f ms", name, Percentile(times, count, 0.5), Percentile(times, count, 0.95), Percentile(times, count, 0.99));
+}
+
+static void Report(struct Benchmark* benchmark) {
+	if (!benchmark->recorded) {
+		return;
+	}
+	if (benchmark->singing < 0) {
+		printf("intro:");
+	} else {
+		printf("%d/%d singing:", benchmark->singing, benchmark->potatoes);
+	}
+	printf(" %d frames,", benchmark->recorded);
+	ReportTimes("draw", benchmark->draw, benchmark->recorded);
+	ReportTimes(", logic", benchmark->logic, benchmark->recorded);
+	printf(", %.1f draws and %.1f binds per frame", benchmark->draws / (double)benchmark->recorded, benchmark->binds / (double)benchmark->recorded);
+	if (benchmark->audio > benchmark->audio_start) {
+		printf(", mixing %.2f ms per second of audio", (benchmark->mixing - benchmark->mixing_start) / (benchmark->audio - benchmark->audio_start) * 1000.0);
+	}
+	printf("\n");
+	fflush(stdout);
+
+	benchmark->recorded = 0;
+	benchmark->draws = 0;
+	benchmark->binds = 0;
+	benchmark->mixing_start = benchmark->mixing;
+	benchmark->audio_start = benchmark->audio;
+}
+
+void StartBenchmarkChoir(struct Benchmark* benchmark, int potatoes) {
+	Report(benchmark);
+	benchmark->potatoes = potatoes;
+	benchmark->singing = 0;
+}
+
+void CountBenchmarkDraws(struct Benchmark* benchmark, int draws, int binds) {
+	benchmark->draws += draws;
+	benchmark->binds += binds;
+}
+
+void SetBenchmarkAudio(struct Benchmark* benchmark, double mixing, double audio) {
+	benchmark->mixing = mixing;
+	benchmark->audio = audio;
+}
+
+void BenchmarkPreLogic(struct Game* game, double delta) {
+	game->data->benchmark->logic_start = al_get_time();
+}
+
+void BenchmarkPostLogic(struct Game* game, double delta) {
+	struct Benchmark* benchmark = game->data->benchmark;
+	benchmark->logic_time += al_get_time() - benchmark->logic_start;
+}
+
+void BenchmarkPreDraw(struct Game* game) {
+	game->data->benchmark->start = al_get_time();
+}
+
+void BenchmarkPostDraw(struct Game* game) {
+	struct Benchmark* benchmark = game->data->benchmark;
+
+	// Drivers queue the drawing up, so wait for it to land by reading a pixel back;
+	// otherwise the rasterization would end up being accounted to whatever comes next.
+	ALLEGRO_BITMAP* target = al_get_target_bitmap();
+	if (al_lock_bitmap_region(target, 0, 0, 1, 1, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_READONLY)) {
+		al_unlock_bitmap(target);
+	}
+
+	if (benchmark->recorded == benchmark->allocated) {
+		benchmark->allocated = benchmark->allocated ? benchmark->allocated * 2 : benchmark->frames;
+		benchmark->draw = realloc(benchmark->draw, sizeof(double) * benchmark->allocated);
+		benchmark->logic = realloc(benchmark->logic, sizeof(double) * benchmark->allocated);
+	}
+	benchmark->draw[benchmark->recorded] = al_get_time() - benchmark->start;
+	benchmark->logic[benchmark->recorded] = benchmark->logic_time;
+	benchmark->recorded++;
+	benchmark->logic_time = 0;
+
+	if (benchmark->singing < 0 || benchmark->recorded < benchmark->frames) {
+		return;
+	}
+	Report(benchmark);
+	benchmark->singing++;
+	if (benchmark->singing > benchmark->potatoes) {
+		UnloadAllGamestates(game);
+	}
+}
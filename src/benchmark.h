@@ -0,0 +1,66 @@
+/*! \file benchmark.h
+ *  \brief Scripted frame time benchmark.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_BENCHMARK_H
+#define POTATOES_BENCHMARK_H
+
+#include <allegro5/allegro.h>
+
+#define BENCHMARK_FRAMES 300 // default number of frames recorded for every arrangement
+
+struct Game;
+
+/*! \brief Frame timings collected while the game plays a script of arrangements.
+ *
+ * Everything up to the start of the choir counts as the intro. Then the choir sings
+ * arrangements of 0, 1, ... up to all of its potatoes, each for the same number of frames,
+ * and the game quits once the last one is done.
+ *
+ * The time the audio thread spends mixing is reported too, so runs with and without
+ * [potatoes] engine=1 compare the mixing engine against the mixer graph.
+ */
+struct Benchmark {
+	int frames; // per arrangement
+	int singing; // potatoes the choir should have singing; -1 during the intro
+	int potatoes; // size of the choir, known once it starts
+
+	int recorded; // frames recorded in the current arrangement
+	int allocated;
+	double *draw, *logic; // per frame, in seconds
+	int draws, binds; // draw calls and texture switches reported in the current arrangement
+	double mixing, audio; // total time spent mixing and audio mixed, as last reported
+	double mixing_start, audio_start; // as of the start of the current arrangement
+
+	double start, logic_start;
+	double logic_time; // spent in logic since the last frame
+};
+
+struct Benchmark* CreateBenchmark(int frames);
+void DestroyBenchmark(struct Benchmark* benchmark);
+void StartBenchmarkChoir(struct Benchmark* benchmark, int potatoes);
+void CountBenchmarkDraws(struct Benchmark* benchmark, int draws, int binds);
+void SetBenchmarkAudio(struct Benchmark* benchmark, double mixing, double audio);
+
+void BenchmarkPreLogic(struct Game* game, double delta);
+void BenchmarkPostLogic(struct Game* game, double delta);
+void BenchmarkPreDraw(struct Game* game);
+void BenchmarkPostDraw(struct Game* game);
+
+#endif
@@ -0,0 +1,190 @@
+/*! \file choir.c
+ *  \brief Data-driven layout of the choir.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "choir.h"
+#include <libsuperderpy.h>
+
+// Area of the stage that gets filled with potatoes in stress mode.
+#define STRESS_LEFT 200
+#define STRESS_TOP 420
+#define STRESS_WIDTH 1520
+#define STRESS_HEIGHT 560
+#define STRESS_SPACING 320 // horizontal distance between potatoes at their scene scale
+
+static struct Choir* CreateChoir(int count) {
+	struct Choir* choir = calloc(1, sizeof(struct Choir));
+	choir->count = count;
+	choir->sprite = calloc(count, sizeof(int));
+	choir->voice = calloc(count, sizeof(int));
+	choir->x = calloc(count, sizeof(float));
+	choir->y = calloc(count, sizeof(float));
+	choir->scale = calloc(count, sizeof(float));
+	choir->pan = calloc(count, sizeof(float));
+	choir->sway = calloc(count, sizeof(float));
+	choir->send = calloc(count, sizeof(float));
+	choir->face_x = calloc(count, sizeof(float));
+	choir->face_y = calloc(count, sizeof(float));
+	choir->face_scale = calloc(count, sizeof(float));
+	choir->mic_x = calloc(count, sizeof(float));
+	choir->mic_y = calloc(count, sizeof(float));
+	choir->mic_scale = calloc(count, sizeof(float));
+	choir->face_flip = calloc(count, sizeof(bool));
+	choir->mic_flip = calloc(count, sizeof(bool));
+	return choir;
+}
+
+void DestroyChoir(struct Choir* choir) {
+	free(choir->sprite);
+	free(choir->voice);
+	free(choir->x);
+	free(choir->y);
+	free(choir->scale);
+	free(choir->pan);
+	free(choir->sway);
+	free(choir->send);
+	free(choir->face_x);
+	free(choir->face_y);
+	free(choir->face_scale);
+	free(choir->mic_x);
+	free(choir->mic_y);
+	free(choir->mic_scale);
+	free(choir->face_flip);
+	free(choir->mic_flip);
+	free(choir);
+}
+
+static double GetValue(ALLEGRO_CONFIG* config, const char* section, const char* key, double def) {
+	const char* value = al_get_config_value(config, section, key);
+	if (!value) {
+		return def;
+	}
+	return strtod(value, NULL);
+}
+
+static int GetIndex(struct Game* game, ALLEGRO_CONFIG* config, const char* section, const char* key, int count) {
+	// Scenes can only pick from the assets that ship with the game; anything else gets clamped
+	// here rather than failing somewhere deep in the loader. The mixdown tool has no console.
+	int value = GetValue(config, section, key, 0);
+	if (value >= 0 && value < count) {
+		return value;
+	}
+	int clamped = value < 0 ? 0 : count - 1;
+	char message[128];
+	snprintf(message, sizeof(message), "%s: %s=%d is out of range (0-%d), using %d", section, key, value, count - 1, clamped);
+	if (game) {
+		PrintConsole(game, "%s", message);
+	} else {
+		fprintf(stderr, "%s\n", message);
+	}
+	return clamped;
+}
+
+static void CountAssets(struct Choir* choir) {
+	choir->sprites = 0;
+	choir->voices = 0;
+	for (int i = 0; i < choir->count; i++) {
+		if (choir->sprite[i] >= choir->sprites) {
+			choir->sprites = choir->sprite[i] + 1;
+		}
+		if (choir->voice[i] >= choir->voices) {
+			choir->voices = choir->voice[i] + 1;
+		}
+	}
+}
+
+static struct Choir* ReplicateChoir(struct Choir* scene, int count) {
+	// Tiles the potatoes from the scene over a grid that fills the stage, scaled down to fit.
+	// Like in the scene, rows are spaced half as far apart as the potatoes within a row.
+	struct Choir* choir = CreateChoir(count);
+	int cols = ceil(sqrt(count * STRESS_WIDTH / (double)STRESS_HEIGHT / 2.0));
+	int rows = (count + cols - 1) / cols;
+	float cell = STRESS_WIDTH / (float)cols;
+	float k = fmin(1.0, fmin(cell / STRESS_SPACING, STRESS_HEIGHT / (float)rows / (STRESS_SPACING / 2.0)));
+
+	for (int i = 0; i < count; i++) {
+		int t = i % scene->count;
+		int col = i % cols, row = i / cols;
+		choir->sprite[i] = scene->sprite[t];
+		choir->voice[i] = scene->voice[t];
+		choir->x[i] = STRESS_LEFT + cell * (col + 0.5);
+		choir->y[i] = STRESS_TOP + STRESS_HEIGHT * (row + 0.5) / rows;
+		choir->scale[i] = scene->scale[t] * k;
+		choir->pan[i] = cols > 1 ? -0.75 + 1.5 * col / (cols - 1) : 0.0;
+		choir->sway[i] = i;
+		choir->send[i] = scene->send[t];
+		choir->face_x[i] = scene->face_x[t] * k;
+		choir->face_y[i] = scene->face_y[t] * k;
+		choir->face_scale[i] = scene->face_scale[t] * k;
+		choir->face_flip[i] = scene->face_flip[t];
+		choir->mic_x[i] = scene->mic_x[t] * k;
+		choir->mic_y[i] = scene->mic_y[t] * k;
+		choir->mic_scale[i] = scene->mic_scale[t] * k;
+		choir->mic_flip[i] = scene->mic_flip[t];
+	}
+	return choir;
+}
+
+struct Choir* LoadChoir(struct Game* game, const char* path, int stress) {
+	ALLEGRO_CONFIG* config = al_load_config_file(path);
+	if (!config) {
+		return NULL;
+	}
+
+	int count = GetValue(config, "choir", "potatoes", 0);
+	if (count <= 0) {
+		al_destroy_config(config);
+		return NULL;
+	}
+
+	float send = GetValue(config, "choir", "send", 0);
+
+	struct Choir* choir = CreateChoir(count);
+	for (int i = 0; i < count; i++) {
+		char section[32];
+		snprintf(section, sizeof(section), "potato%d", i);
+		choir->sprite[i] = GetIndex(game, config, section, "sprite", CHOIR_SPRITES);
+		choir->voice[i] = GetIndex(game, config, section, "voice", CHOIR_VOICES);
+		choir->x[i] = GetValue(config, section, "x", 0);
+		choir->y[i] = GetValue(config, section, "y", 0);
+		choir->scale[i] = GetValue(config, section, "scale", 1);
+		choir->pan[i] = GetValue(config, section, "pan", 0);
+		choir->sway[i] = GetValue(config, section, "sway", i);
+		choir->send[i] = GetValue(config, section, "send", send);
+		choir->face_x[i] = GetValue(config, section, "face_x", 0);
+		choir->face_y[i] = GetValue(config, section, "face_y", 0);
+		choir->face_scale[i] = GetValue(config, section, "face_scale", 1);
+		choir->face_flip[i] = GetValue(config, section, "face_flip", 0);
+		choir->mic_x[i] = GetValue(config, section, "mic_x", 0);
+		choir->mic_y[i] = GetValue(config, section, "mic_y", 0);
+		choir->mic_scale[i] = GetValue(config, section, "mic_scale", 0.2);
+		choir->mic_flip[i] = GetValue(config, section, "mic_flip", 0);
+	}
+	al_destroy_config(config);
+
+	if (stress > 0) {
+		struct Choir* scene = choir;
+		choir = ReplicateChoir(scene, stress);
+		DestroyChoir(scene);
+	}
+
+	CountAssets(choir);
+	return choir;
+}
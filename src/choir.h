@@ -0,0 +1,52 @@
+/*! \file choir.h
+ *  \brief Data-driven layout of the choir.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_CHOIR_H
+#define POTATOES_CHOIR_H
+
+#include <allegro5/allegro.h>
+
+#define CHOIR_MODES 5 // loops per voice
+#define CHOIR_SPRITES 8 // potato sprites shipped in data/sprites/potato
+#define CHOIR_VOICES 8 // loop sets shipped in data/p*
+
+struct Game;
+
+/*! \brief Layout of every potato on the stage, as loaded from the scene description.
+ *
+ * Kept as flat arrays indexed by potato, so the per-frame loops only touch what they need.
+ */
+struct Choir {
+	int count; // potatoes
+	int sprites; // potato sprites used, highest index + 1
+	int voices; // loop sets used, highest index + 1
+
+	int *sprite, *voice;
+	float *x, *y, *scale, *pan, *sway;
+	float* send; // level into the shared reverb
+	float *face_x, *face_y, *face_scale;
+	float *mic_x, *mic_y, *mic_scale;
+	bool *face_flip, *mic_flip;
+};
+
+struct Choir* LoadChoir(struct Game* game, const char* path, int stress);
+void DestroyChoir(struct Choir* choir);
+
+#endif
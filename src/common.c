@@ -19,8 +19,23 @@
  */
 
 #include "common.h"
+#include "benchmark.h"
+#include "trace.h"
 #include <libsuperderpy.h>
 
+static void DumpTraceFile(struct Game* game) {
+	ALLEGRO_PATH* path = al_get_standard_path(ALLEGRO_USER_DATA_PATH);
+	al_make_directory(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	al_set_path_filename(path, "trace.json");
+	const char* filename = game->data->trace ? game->data->trace : al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP);
+	if (DumpTrace(filename)) {
+		PrintConsole(game, "Trace written to %s", filename);
+	} else {
+		PrintConsole(game, "Could not write the trace to %s", filename);
+	}
+	al_destroy_path(path);
+}
+
 bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev) {
 	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_M)) {
 		ToggleMute(game);
@@ -30,6 +45,15 @@ bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev) {
 		ToggleFullscreen(game);
 	}
 
+	// T shows the timing overlay (and starts recording), Shift+T dumps what's been recorded.
+	if ((ev->type == ALLEGRO_EVENT_KEY_CHAR) && (ev->keyboard.keycode == ALLEGRO_KEY_T) && !ev->keyboard.repeat) {
+		if (ev->keyboard.modifiers & ALLEGRO_KEYMOD_SHIFT) {
+			DumpTraceFile(game);
+		} else {
+			ToggleTraceOverlay();
+		}
+	}
+
 #ifdef ALLEGRO_ANDROID
 	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_BACK)) {
 		QuitGame(game, true);
@@ -39,11 +63,35 @@ bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev) {
 	return false;
 }
 
-struct CommonResources* CreateGameData(struct Game* game) {
+void GlobalPostDraw(struct Game* game) {
+	DrawTraceOverlay(game);
+	if (game->data->benchmark) {
+		BenchmarkPostDraw(game);
+	}
+}
+
+struct CommonResources* CreateGameData(struct Game* game, double startup) {
 	struct CommonResources* data = calloc(1, sizeof(struct CommonResources));
+	SetTraceThreadName("main");
+	data->startup = startup;
+
+	// Recording from the start, the trace gets dumped to the given file on exit.
+	const char* trace = GetConfigOptionDefault(game, "potatoes", "trace", "");
+	if (trace[0]) {
+		data->trace = strdup(trace);
+		EnableTracing(true);
+	}
 	return data;
 }
 
 void DestroyGameData(struct Game* game) {
+	if (game->data->benchmark) {
+		DestroyBenchmark(game->data->benchmark);
+	}
+	if (game->data->trace) {
+		DumpTraceFile(game);
+		free(game->data->trace);
+	}
+	DestroyTraceOverlay();
 	free(game->data);
 }
@@ -18,11 +18,17 @@
 #define LIBSUPERDERPY_DATA_TYPE struct CommonResources
 #include <libsuperderpy.h>
 
+struct Benchmark;
+
 struct CommonResources {
 	// Fill in with common data accessible from all gamestates.
 	float mouseX, mouseY;
+	struct Benchmark* benchmark; // NULL unless running with --benchmark
+	char* trace; // where the trace gets dumped on exit; NULL when not recording from the start
+	double startup; // time right before the engine got initialized; 0 once the choir has been shown
 };
 
-struct CommonResources* CreateGameData(struct Game* game);
+struct CommonResources* CreateGameData(struct Game* game, double startup);
 void DestroyGameData(struct Game* game);
 bool GlobalEventHandler(struct Game* game, ALLEGRO_EVENT* ev);
+void GlobalPostDraw(struct Game* game);
@@ -0,0 +1,159 @@
+/*! \file compressed.c
+ *  \brief Choir loops kept compressed in memory and decoded while they play.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "compressed.h"
+#include <libsuperderpy.h>
+
+// Read-only file handle over a compressed sample. Every stream gets its own, so they can seek independently.
+struct MemoryFile {
+	struct CompressedSample* sample;
+	int64_t position;
+};
+
+static bool MemoryClose(ALLEGRO_FILE* file) {
+	free(al_get_file_userdata(file));
+	return true;
+}
+
+static size_t MemoryRead(ALLEGRO_FILE* file, void* ptr, size_t size) {
+	struct MemoryFile* mem = al_get_file_userdata(file);
+	int64_t left = mem->sample->size - mem->position;
+	if ((int64_t)size > left) {
+		size = left > 0 ? left : 0;
+	}
+	memcpy(ptr, (char*)mem->sample->data + mem->position, size);
+	mem->position += size;
+	return size;
+}
+
+static size_t MemoryWrite(ALLEGRO_FILE* file, const void* ptr, size_t size) {
+	return 0;
+}
+
+static bool MemoryFlush(ALLEGRO_FILE* file) {
+	return true;
+}
+
+static int64_t MemoryTell(ALLEGRO_FILE* file) {
+	struct MemoryFile* mem = al_get_file_userdata(file);
+	return mem->position;
+}
+
+static bool MemorySeek(ALLEGRO_FILE* file, int64_t offset, int whence) {
+	struct MemoryFile* mem = al_get_file_userdata(file);
+	int64_t position = offset;
+	if (whence == ALLEGRO_SEEK_CUR) {
+		position += mem->position;
+	} else if (whence == ALLEGRO_SEEK_END) {
+		position += mem->sample->size;
+	}
+	if (position < 0 || position > (int64_t)mem->sample->size) {
+		return false;
+	}
+	mem->position = position;
+	return true;
+}
+
+static bool MemoryEOF(ALLEGRO_FILE* file) {
+	struct MemoryFile* mem = al_get_file_userdata(file);
+	return mem->position >= (int64_t)mem->sample->size;
+}
+
+static int MemoryError(ALLEGRO_FILE* file) {
+	return 0;
+}
+
+static const char* MemoryErrorMessage(ALLEGRO_FILE* file) {
+	return "";
+}
+
+static void MemoryClearError(ALLEGRO_FILE* file) {}
+
+static int MemoryUngetc(ALLEGRO_FILE* file, int c) {
+	struct MemoryFile* mem = al_get_file_userdata(file);
+	if (mem->position <= 0) {
+		return EOF;
+	}
+	mem->position--;
+	return c;
+}
+
+static off_t MemorySize(ALLEGRO_FILE* file) {
+	struct MemoryFile* mem = al_get_file_userdata(file);
+	return mem->sample->size;
+}
+
+static const ALLEGRO_FILE_INTERFACE memory_interface = {
+	.fi_fclose = MemoryClose,
+	.fi_fread = MemoryRead,
+	.fi_fwrite = MemoryWrite,
+	.fi_fflush = MemoryFlush,
+	.fi_ftell = MemoryTell,
+	.fi_fseek = MemorySeek,
+	.fi_feof = MemoryEOF,
+	.fi_ferror = MemoryError,
+	.fi_ferrmsg = MemoryErrorMessage,
+	.fi_fclearerr = MemoryClearError,
+	.fi_fungetc = MemoryUngetc,
+	.fi_fsize = MemorySize,
+};
+
+struct CompressedSample* LoadCompressedSample(const char* path) {
+	ALLEGRO_FILE* file = al_fopen(path, "rb");
+	if (!file) {
+		return NULL;
+	}
+	struct CompressedSample* sample = calloc(1, sizeof(struct CompressedSample));
+	sample->size = al_fsize(file);
+	sample->data = malloc(sample->size);
+	bool ok = al_fread(file, sample->data, sample->size) == sample->size;
+	al_fclose(file);
+	if (!ok) {
+		DestroyCompressedSample(sample);
+		return NULL;
+	}
+
+	const char* ext = strrchr(path, '.');
+	snprintf(sample->ext, sizeof(sample->ext), "%s", ext ? ext : "");
+	return sample;
+}
+
+ALLEGRO_AUDIO_STREAM* CreateCompressedStream(struct CompressedSample* sample, size_t fragments, unsigned int samples) {
+	struct MemoryFile* mem = calloc(1, sizeof(struct MemoryFile));
+	mem->sample = sample;
+	ALLEGRO_FILE* file = al_create_file_handle(&memory_interface, mem);
+	if (!file) {
+		free(mem);
+		return NULL;
+	}
+
+	// On success, the stream takes over the file and closes it once destroyed.
+	ALLEGRO_AUDIO_STREAM* stream = al_load_audio_stream_f(file, sample->ext, fragments, samples);
+	if (!stream) {
+		al_fclose(file);
+	}
+	return stream;
+}
+
+void DestroyCompressedSample(struct CompressedSample* sample) {
+	free(sample->data);
+	free(sample);
+}
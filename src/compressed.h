@@ -0,0 +1,43 @@
+/*! \file compressed.h
+ *  \brief Choir loops kept compressed in memory and decoded while they play.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_COMPRESSED_H
+#define POTATOES_COMPRESSED_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+
+/*! \brief Encoded file of a loop, read into memory as-is.
+ *
+ * Audio streams get opened on top of it the same way as on top of the file on disk, so only
+ * the fragments queued ahead of the play cursor of an audible loop ever get decoded. Seeking
+ * goes through the codec's own index (a FLAC seek table, an Ogg page bisection) and costs no I/O.
+ */
+struct CompressedSample {
+	void* data;
+	size_t size;
+	char ext[8]; // file extension, tells Allegro which decoder to use
+};
+
+struct CompressedSample* LoadCompressedSample(const char* path);
+ALLEGRO_AUDIO_STREAM* CreateCompressedStream(struct CompressedSample* sample, size_t fragments, unsigned int samples);
+void DestroyCompressedSample(struct CompressedSample* sample);
+
+#endif
@@ -0,0 +1,175 @@
+/*! \file deadline.c
+ *  \brief Audio callback deadline monitor.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "deadline.h"
+#include "seqlock.h"
+#include <libsuperderpy.h>
+
+static void HeadPostprocess(void* buffer, unsigned int samples, void* userdata) {
+	struct DeadlineMonitor* monitor = userdata;
+	double now = al_get_time();
+	monitor->interval = monitor->start ? now - monitor->start : 0.0;
+	monitor->start = now;
+	monitor->mark = now;
+}
+
+struct DeadlineMonitor* CreateDeadlineMonitor(struct Game* game, ALLEGRO_MIXER* mixer, int stages) {
+	struct DeadlineMonitor* monitor = calloc(1, sizeof(struct DeadlineMonitor));
+	atomic_init(&monitor->sequence, 0);
+	monitor->frequency = al_get_voice_frequency(game->audio.v);
+	monitor->stages = stages;
+	monitor->costs = calloc(stages, sizeof(double));
+	monitor->stage = calloc(stages, sizeof(struct DeadlineStage));
+
+	const char* path = GetConfigOptionDefault(game, "potatoes", "audiostats", "");
+	if (path[0]) {
+		monitor->path = strdup(path);
+	}
+	monitor->flushed = al_get_time();
+
+	monitor->head = al_create_mixer(al_get_mixer_frequency(mixer), ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
+	al_set_mixer_postprocess_callback(monitor->head, HeadPostprocess, monitor);
+	al_attach_mixer_to_mixer(monitor->head, mixer);
+	return monitor;
+}
+
+void DestroyDeadlineMonitor(struct DeadlineMonitor* monitor) {
+	al_destroy_mixer(monitor->head);
+	free(monitor->costs);
+	free(monitor->stage);
+	free(monitor->path);
+	free(monitor);
+}
+
+void MarkDeadlineStage(struct DeadlineMonitor* monitor, int stage) {
+	double now = al_get_time();
+	monitor->costs[stage] += now - monitor->mark;
+	monitor->mark = now;
+}
+
+void AddDeadlineStage(struct DeadlineMonitor* monitor, int stage, double cost) {
+	// For stages timed by whoever runs them, possibly on another thread than the audio one;
+	// it must be done before the block ends, and a stage may only be run by one thread at a time.
+	monitor->costs[stage] += cost;
+}
+
+void EndDeadlineBlock(struct DeadlineMonitor* monitor, unsigned int frames) {
+	if (!monitor->start) {
+		return; // the head hasn't been mixed yet
+	}
+	double cost = al_get_time() - monitor->start;
+	double period = frames / (double)monitor->frequency;
+	double interval = monitor->interval;
+
+	BeginSeqlockWrite(&monitor->sequence);
+
+	struct DeadlineStats* stats = &monitor->stats;
+	stats->blocks++;
+	stats->period = period;
+	stats->cost_total += cost;
+	if (cost > stats->cost_max) {
+		stats->cost_max = cost;
+	}
+	if (interval > stats->interval_max) {
+		stats->interval_max = interval;
+	}
+	// With double buffering, a callback coming later than two periods after the previous one
+	// means the device has been left without anything to play.
+	if (cost > period || interval > period * 2.0) {
+		stats->xruns++;
+	} else if (cost > period * DEADLINE_NEAR_MISS) {
+		stats->near_misses++;
+	}
+	int bucket = cost / period * 10.0;
+	stats->histogram[bucket < DEADLINE_BUCKETS ? bucket : DEADLINE_BUCKETS - 1]++;
+
+	for (int i = 0; i < monitor->stages; i++) {
+		monitor->stage[i].total += monitor->costs[i];
+		if (monitor->costs[i] > monitor->stage[i].max) {
+			monitor->stage[i].max = monitor->costs[i];
+		}
+		monitor->costs[i] = 0.0;
+	}
+
+	EndSeqlockWrite(&monitor->sequence);
+}
+
+void ReadDeadlineStats(struct DeadlineMonitor* monitor, struct DeadlineStats* stats, struct DeadlineStage* stages) {
+	unsigned int before;
+	do {
+		before = BeginSeqlockRead(&monitor->sequence);
+		memcpy(stats, &monitor->stats, sizeof(struct DeadlineStats));
+		if (stages) {
+			memcpy(stages, monitor->stage, sizeof(struct DeadlineStage) * monitor->stages);
+		}
+	} while (RetrySeqlockRead(&monitor->sequence, before));
+}
+
+void PrintDeadlineStats(struct Game* game, struct DeadlineMonitor* monitor) {
+	struct DeadlineStats stats;
+	ReadDeadlineStats(monitor, &stats, NULL);
+	if (!stats.blocks) {
+		return;
+	}
+	PrintConsole(game, "audio: %u blocks of %.1f ms, mixing avg %.2f ms, max %.2f ms (%.2f ms per second of audio); %u near misses, %u xruns",
+		stats.blocks, stats.period * 1000.0, stats.cost_total / stats.blocks * 1000.0, stats.cost_max * 1000.0,
+		stats.cost_total / (stats.blocks * stats.period) * 1000.0, stats.near_misses, stats.xruns);
+}
+
+static void WriteDeadlineStats(struct DeadlineMonitor* monitor) {
+	struct DeadlineStats stats;
+	struct DeadlineStage* stages = malloc(sizeof(struct DeadlineStage) * monitor->stages);
+	ReadDeadlineStats(monitor, &stats, stages);
+
+	FILE* file = fopen(monitor->path, "w");
+	if (file) {
+		fprintf(file, "blocks %u\nperiod_ms %.3f\n", stats.blocks, stats.period * 1000.0);
+		fprintf(file, "cost_avg_ms %.3f\ncost_max_ms %.3f\n", stats.blocks ? stats.cost_total / stats.blocks * 1000.0 : 0.0, stats.cost_max * 1000.0);
+		fprintf(file, "interval_max_ms %.3f\n", stats.interval_max * 1000.0);
+		fprintf(file, "near_misses %u\nxruns %u\n", stats.near_misses, stats.xruns);
+		for (int i = 0; i < DEADLINE_BUCKETS; i++) {
+			fprintf(file, "load_%d%s %u\n", i * 10, i == DEADLINE_BUCKETS - 1 ? "+" : "", stats.histogram[i]);
+		}
+		for (int i = 0; i < monitor->stages; i++) {
+			fprintf(file, "stage_%d_avg_ms %.3f\nstage_%d_max_ms %.3f\n", i, stats.blocks ? stages[i].total / stats.blocks * 1000.0 : 0.0, i, stages[i].max * 1000.0);
+		}
+		fclose(file);
+	}
+	free(stages);
+}
+
+void UpdateDeadlineMonitor(struct Game* game, struct DeadlineMonitor* monitor) {
+	double now = al_get_time();
+	if (now - monitor->flushed < DEADLINE_FLUSH) {
+		return;
+	}
+	monitor->flushed = now;
+
+	struct DeadlineStats stats;
+	ReadDeadlineStats(monitor, &stats, NULL);
+	if (stats.xruns != monitor->reported) {
+		monitor->reported = stats.xruns;
+		PrintDeadlineStats(game, monitor);
+	}
+	if (monitor->path) {
+		WriteDeadlineStats(monitor);
+	}
+}
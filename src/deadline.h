@@ -0,0 +1,84 @@
+/*! \file deadline.h
+ *  \brief Audio callback deadline monitor.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_DEADLINE_H
+#define POTATOES_DEADLINE_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+#include <stdatomic.h>
+
+#define DEADLINE_NEAR_MISS 0.75 // share of the buffer period above which a block counts as a near miss
+#define DEADLINE_BUCKETS 11 // histogram of the cost relative to the period, in 10% steps; the last one is everything above
+#define DEADLINE_FLUSH 5.0 // seconds between writes of the stats file
+
+struct Game;
+
+struct DeadlineStats {
+	unsigned int blocks;
+	unsigned int near_misses; // cost above DEADLINE_NEAR_MISS of the period
+	unsigned int xruns; // cost above the period, or a callback so late that the device must have run dry
+	unsigned int histogram[DEADLINE_BUCKETS];
+	double period; // of the last block, in seconds
+	double cost_total, cost_max; // time spent mixing, in seconds
+	double interval_max; // longest time between the starts of two blocks
+};
+
+struct DeadlineStage {
+	double total, max;
+};
+
+/*! \brief Measures how much of each audio buffer period the mixing takes.
+ *
+ * An empty mixer is attached to the monitored one before anything else, so its postprocess
+ * callback marks the moment the voice callback starts mixing it. Every stage (e.g. a child
+ * mixer's postprocess) marks when it's done, and whoever owns the monitored mixer ends the block
+ * from its postprocess. Stats are handed over to the main thread through a seqlock.
+ */
+struct DeadlineMonitor {
+	ALLEGRO_MIXER* head;
+	unsigned int frequency; // of the voice
+	int stages;
+
+	// audio thread only
+	double start, mark;
+	double interval; // between the starts of the current and the previous block
+	double* costs; // of every stage in the current block
+
+	atomic_uint sequence;
+	struct DeadlineStats stats;
+	struct DeadlineStage* stage;
+
+	// main thread only
+	char* path;
+	double flushed;
+	unsigned int reported; // xruns already reported on the console
+};
+
+struct DeadlineMonitor* CreateDeadlineMonitor(struct Game* game, ALLEGRO_MIXER* mixer, int stages);
+void DestroyDeadlineMonitor(struct DeadlineMonitor* monitor);
+void MarkDeadlineStage(struct DeadlineMonitor* monitor, int stage);
+void AddDeadlineStage(struct DeadlineMonitor* monitor, int stage, double cost);
+void EndDeadlineBlock(struct DeadlineMonitor* monitor, unsigned int frames);
+void ReadDeadlineStats(struct DeadlineMonitor* monitor, struct DeadlineStats* stats, struct DeadlineStage* stages);
+void PrintDeadlineStats(struct Game* game, struct DeadlineMonitor* monitor);
+void UpdateDeadlineMonitor(struct Game* game, struct DeadlineMonitor* monitor);
+
+#endif
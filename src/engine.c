@@ -0,0 +1,183 @@
+/*! \file engine.c
+ *  \brief Mixing engine rendering the whole choir in a single pass.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "engine.h"
+#include "deadline.h"
+#include "scheduler.h"
+#include "sendbus.h"
+#include "simd.h"
+#include "submix.h"
+#include "transport.h"
+#include <libsuperderpy.h>
+
+static void SyncEngineVoice(struct Engine* engine, struct MixdownVoice* voice, uint64_t frame) {
+	// Same position as SyncSampleInstance would give, including the fractional part.
+	struct Transport* transport = engine->transport;
+	uint64_t elapsed = (frame - transport->origin) * transport->frequency;
+	voice->position = elapsed / engine->frequency % transport->length;
+	voice->error = elapsed % engine->frequency;
+}
+
+static void AddBuffer(float* dst, const float* src, unsigned int count) {
+	unsigned int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		v4sf_store(dst + i, v4sf_load(dst + i) + v4sf_load(src + i));
+	}
+	for (; i < count; i++) {
+		dst[i] += src[i];
+	}
+}
+
+static void MixEngineDeck(struct Engine* engine, int index, struct EngineLane* lane, struct EngineVoice* d, unsigned int samples, uint64_t start) {
+	// A late worker may still read the envelope after the audio thread moved on, like a seqlock
+	// reader would; what it renders then gets thrown away by the submix pool.
+	struct EngineDeck* e = &engine->decks[index];
+	struct EnginePotato* potato = &engine->potatoes[index / 2];
+	struct Deck* deck = &engine->scheduler->decks[index];
+
+	const float* data = atomic_load_explicit(&e->data, memory_order_acquire);
+	if (data != d->playing) {
+		d->playing = data;
+		d->next = UINT64_MAX;
+		if (data) {
+			InitMixdownVoice(&d->voice, data, engine->transport->length, engine->transport->frequency, potato->pan);
+		}
+	}
+
+	bool ramping = IsDeckRamping(deck, start, samples);
+	float gain = GetDeckGain(deck, start);
+	if (!data || (!ramping && gain == 0.0)) {
+		// Silent decks cost nothing; the voice catches up with the transport once it's audible again.
+		return;
+	}
+
+	if (d->next != start) {
+		SyncEngineVoice(engine, &d->voice, start);
+	}
+	d->next = start + samples;
+
+	if (!ramping && gain == 1.0) {
+		MixVoice(&d->voice, lane->scratch, samples, engine->frequency);
+		return;
+	}
+	memset(lane->deck, 0, sizeof(float) * samples * 2);
+	MixVoice(&d->voice, lane->deck, samples, engine->frequency);
+	ApplyDeckGain(deck, lane->deck, samples, start);
+	AddBuffer(lane->scratch, lane->deck, samples * 2);
+}
+
+static void RenderEnginePotato(void* userdata, int index, int lane, bool owner) {
+	// Only the owner may run the postprocess, which keeps state of its own across blocks.
+	struct Engine* engine = userdata;
+	struct EnginePotato* potato = &engine->potatoes[index];
+	struct EngineLane* l = &potato->lane[lane];
+	double start = al_get_time();
+
+	memset(l->scratch, 0, sizeof(float) * engine->block * 2);
+	MixEngineDeck(engine, index * 2, l, &engine->decks[index * 2].lane[lane], engine->block, engine->start);
+	MixEngineDeck(engine, index * 2 + 1, l, &engine->decks[index * 2 + 1].lane[lane], engine->block, engine->start);
+	if (owner && potato->postprocess) {
+		potato->postprocess(l->scratch, engine->block, potato->userdata);
+	}
+	l->cost = al_get_time() - start;
+}
+
+static void EnginePostprocess(void* buffer, unsigned int samples, void* userdata) {
+	// The mixer has no inputs, so the buffer starts out silent and the choir gets rendered into it.
+	struct Engine* engine = userdata;
+	uint64_t frame = atomic_load_explicit(&engine->transport->frames, memory_order_relaxed);
+	float* output = buffer;
+	UpdateScheduler(engine->scheduler, samples); // before any worker looks at the decks
+	struct DeadlineMonitor* monitor = atomic_load_explicit(&engine->transport->monitor, memory_order_acquire);
+
+	for (unsigned int done = 0; done < samples;) {
+		unsigned int block = samples - done < MIXDOWN_BLOCK ? samples - done : MIXDOWN_BLOCK;
+		engine->start = frame + done;
+		engine->block = block;
+		if (engine->submix) {
+			RunSubmixJobs(engine->submix, engine->count, block * SUBMIX_WAIT / engine->frequency);
+		} else {
+			for (int i = 0; i < engine->count; i++) {
+				RenderEnginePotato(engine, i, SUBMIX_LANE_AUDIO, true);
+			}
+		}
+		for (int i = 0; i < engine->count; i++) {
+			struct EngineLane* lane = &engine->potatoes[i].lane[engine->submix ? GetSubmixLane(engine->submix, i) : SUBMIX_LANE_AUDIO];
+			AddBuffer(output + done * 2, lane->scratch, block * 2);
+			if (engine->bus) {
+				SendToBus(engine->bus, lane->scratch, block, done, engine->potatoes[i].send);
+			}
+			// Potatoes may be rendered side by side, so each one got timed on its own.
+			if (monitor) {
+				AddDeadlineStage(monitor, i, lane->cost);
+			}
+		}
+		// Published from here rather than by the jobs, so a late worker can't overwrite them.
+		for (int i = 0; i < engine->count * 2; i++) {
+			UpdateDeckState(&engine->scheduler->decks[i], engine->start + block, block);
+		}
+		done += block;
+	}
+}
+
+struct Engine* CreateEngine(struct Scheduler* scheduler, struct SendBus* bus, int potatoes, int threads) {
+	struct Engine* engine = calloc(1, sizeof(struct Engine));
+	engine->scheduler = scheduler;
+	engine->bus = bus;
+	engine->transport = scheduler->transport;
+	engine->frequency = scheduler->frequency;
+	engine->count = potatoes;
+	engine->potatoes = calloc(potatoes, sizeof(struct EnginePotato));
+	engine->decks = calloc(potatoes * 2, sizeof(struct EngineDeck));
+	for (int i = 0; i < potatoes * 2; i++) {
+		atomic_init(&engine->decks[i].data, NULL);
+	}
+	if (threads > 0) {
+		engine->submix = CreateSubmixPool(threads, potatoes, RenderEnginePotato, engine);
+	}
+
+	engine->mixer = al_create_mixer(engine->frequency, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
+	al_set_mixer_postprocess_callback(engine->mixer, EnginePostprocess, engine);
+	al_attach_mixer_to_mixer(engine->mixer, engine->transport->mixer);
+	return engine;
+}
+
+void DestroyEngine(struct Engine* engine) {
+	al_destroy_mixer(engine->mixer);
+	if (engine->submix) {
+		DestroySubmixPool(engine->submix);
+	}
+	free(engine->potatoes);
+	free(engine->decks);
+	free(engine);
+}
+
+void SetEnginePotato(struct Engine* engine, int potato, float pan, float send, void (*postprocess)(void*, unsigned int, void*), void* userdata) {
+	// Only called before the potato gets anything to sing.
+	engine->potatoes[potato].pan = pan;
+	engine->potatoes[potato].send = send;
+	engine->potatoes[potato].postprocess = postprocess;
+	engine->potatoes[potato].userdata = userdata;
+}
+
+void SetEngineDeck(struct Engine* engine, int deck, const float* data) {
+	atomic_store_explicit(&engine->decks[deck].data, data, memory_order_release);
+}
@@ -0,0 +1,98 @@
+/*! \file engine.h
+ *  \brief Mixing engine rendering the whole choir in a single pass.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_ENGINE_H
+#define POTATOES_ENGINE_H
+
+#include "mixdown.h"
+#include "submix.h"
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+struct Scheduler;
+struct SendBus;
+struct SubmixPool;
+struct Transport;
+
+struct EngineVoice {
+	const float* playing;
+	struct MixdownVoice voice;
+	uint64_t next; // transport frame the voice's position belongs to
+};
+
+struct EngineDeck {
+	const float* _Atomic data; // loop data; only changed by the main thread while the deck is silent
+	struct EngineVoice lane[SUBMIX_LANES]; // one per submix lane, as a late worker may still be using its own
+};
+
+struct EngineLane {
+	float scratch[MIXDOWN_BLOCK * 2];
+	float deck[MIXDOWN_BLOCK * 2];
+	double cost; // of rendering the potato into it
+};
+
+struct EnginePotato {
+	float pan;
+	float send; // level into the send bus
+	void (*postprocess)(void* buffer, unsigned int samples, void* userdata); // sees the potato's own mix
+	void* userdata;
+
+	// Each potato renders on whichever thread claims it, so it has buffers of its own.
+	struct EngineLane lane[SUBMIX_LANES];
+};
+
+/*! \brief Replacement for the per-potato mixers, decks and sample instances.
+ *
+ * Instead of going through a mixer per potato and a deck and a sample instance per loop, every
+ * potato is rendered by the mixdown kernels into a scratch buffer, which is then handed to the
+ * potato's postprocess callback (so the analysis runs on it while it's hot) and summed into the
+ * output. That happens in the postprocess callback of a single empty mixer attached to the
+ * transport, which drains the scheduler's queue first, so it stays in lockstep with the transport
+ * and deck envelopes.
+ *
+ * Potatoes don't depend on each other, so with a submix pool they get rendered in parallel, one
+ * job per potato and block. Summing and sending to the bus are left to the audio thread, in potato
+ * order, so the output doesn't depend on which thread rendered what.
+ */
+struct Engine {
+	ALLEGRO_MIXER* mixer;
+	struct Scheduler* scheduler;
+	struct Transport* transport;
+	unsigned int frequency; // of the mixer; the loops' length and rate come from the transport
+
+	int count;
+	struct EnginePotato* potatoes;
+	struct EngineDeck* decks; // two per potato, like the scheduler's
+	struct SubmixPool* submix; // NULL to render everything on the audio thread
+	struct SendBus* bus; // optional; only changed while the engine isn't attached
+
+	// block being rendered; set by the audio thread before the jobs get run
+	uint64_t start;
+	unsigned int block;
+};
+
+struct Engine* CreateEngine(struct Scheduler* scheduler, struct SendBus* bus, int potatoes, int threads);
+void DestroyEngine(struct Engine* engine);
+void SetEnginePotato(struct Engine* engine, int potato, float pan, float send, void (*postprocess)(void*, unsigned int, void*), void* userdata);
+void SetEngineDeck(struct Engine* engine, int deck, const float* data);
+
+#endif
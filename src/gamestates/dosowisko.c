@@ -19,6 +19,7 @@
  */
 
 #include "../common.h"
+#include "../trace.h"
 #include <libsuperderpy.h>
 #include <math.h>
 
@@ -35,6 +36,12 @@ struct GamestateResources {
 	char text[255];
 	bool underscore, fadeout;
 	struct Timeline* timeline;
+
+	// What the offscreen bitmaps show, so they only get redrawn when it changes.
+	bool dirty; // the text has changed or the bitmaps have been lost
+	bool drawn_underscore;
+	int drawn_fade;
+	double drawn_tan;
 };
 
 int Gamestate_ProgressCount = 5;
@@ -81,6 +88,7 @@ static TM_ACTION(Type) {
 	TM_RunningOnly;
 	strncpy(data->text, text, data->pos++);
 	data->text[data->pos] = 0;
+	data->dirty = true;
 	if (strcmp(data->text, text) != 0) {
 		TM_AddBackgroundAction(data->timeline, Type, NULL, (60 + rand() % 60) / 1000.0);
 	} else {
@@ -91,44 +99,55 @@ static TM_ACTION(Type) {
 //==================================Timeline manager actions END
 
 void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double delta) {
+	TRACE_SCOPE("dosowisko Logic");
 	TM_Process(data->timeline, delta);
 	data->underscore = Fract(game->time) >= 0.5;
 }
 
 void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
+	TRACE_SCOPE("dosowisko Draw");
 	if (!data->fadeout) {
-		char t[255] = "";
-		strncpy(t, data->text, 255);
-		if (data->underscore) {
-			strncat(t, "_", 2);
-		} else {
-			strncat(t, " ", 2);
-		}
+		// Most frames only blink the cursor (twice a second) or show nothing new at all,
+		// so the offscreen bitmaps are kept and only scaled up to the screen.
+		int fade = data->fade;
+		bool text_changed = data->dirty || data->underscore != data->drawn_underscore;
+		bool changed = text_changed || fade != data->drawn_fade || data->tan != data->drawn_tan;
+
+		if (text_changed) {
+			char t[sizeof(data->text) + 1];
+			snprintf(t, sizeof(t), "%s%c", data->text, data->underscore ? '_' : ' ');
 
-		al_set_target_bitmap(data->bitmap);
-		al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+			al_set_target_bitmap(data->bitmap);
+			al_clear_to_color(al_map_rgba(0, 0, 0, 0));
 
-		al_draw_text(data->font, al_map_rgba(255, 255, 255, 10), 320 / 2.0,
-			180 * 0.4167, ALLEGRO_ALIGN_CENTRE, t);
+			al_draw_text(data->font, al_map_rgba(255, 255, 255, 10), 320 / 2.0,
+				180 * 0.4167, ALLEGRO_ALIGN_CENTRE, t);
 
-		double tg = tan(-data->tan / 384.0 * ALLEGRO_PI - ALLEGRO_PI / 2);
+			data->dirty = false;
+			data->drawn_underscore = data->underscore;
+		}
+
+		if (changed) {
+			double tg = tan(-data->tan / 384.0 * ALLEGRO_PI - ALLEGRO_PI / 2);
 
-		int fade = data->fadeout ? 255 : (int)(data->fade);
+			al_set_target_bitmap(data->pixelator);
+			al_clear_to_color(al_map_rgb(35, 31, 32));
 
-		al_set_target_bitmap(data->pixelator);
-		al_clear_to_color(al_map_rgb(35, 31, 32));
+			al_draw_tinted_scaled_bitmap(data->bitmap, al_map_rgba(fade, fade, fade, fade), 0, 0,
+				al_get_bitmap_width(data->bitmap), al_get_bitmap_height(data->bitmap),
+				-tg * al_get_bitmap_width(data->bitmap) * 0.05,
+				-tg * al_get_bitmap_height(data->bitmap) * 0.05,
+				al_get_bitmap_width(data->bitmap) + tg * 0.1 * al_get_bitmap_width(data->bitmap),
+				al_get_bitmap_height(data->bitmap) + tg * 0.1 * al_get_bitmap_height(data->bitmap),
+				0);
 
-		al_draw_tinted_scaled_bitmap(data->bitmap, al_map_rgba(fade, fade, fade, fade), 0, 0,
-			al_get_bitmap_width(data->bitmap), al_get_bitmap_height(data->bitmap),
-			-tg * al_get_bitmap_width(data->bitmap) * 0.05,
-			-tg * al_get_bitmap_height(data->bitmap) * 0.05,
-			al_get_bitmap_width(data->bitmap) + tg * 0.1 * al_get_bitmap_width(data->bitmap),
-			al_get_bitmap_height(data->bitmap) + tg * 0.1 * al_get_bitmap_height(data->bitmap),
-			0);
+			al_draw_bitmap(data->checkerboard, 0, 0, 0);
 
-		al_draw_bitmap(data->checkerboard, 0, 0, 0);
+			data->drawn_fade = fade;
+			data->drawn_tan = data->tan;
 
-		SetFramebufferAsTarget(game);
+			SetFramebufferAsTarget(game);
+		}
 
 		al_draw_scaled_bitmap(data->pixelator, 0, 0, 320, 180, 0, 0, game->viewport.width, game->viewport.height, 0);
 	}
@@ -140,6 +159,7 @@ void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 	data->tan = 64;
 	data->fadeout = false;
 	data->underscore = true;
+	data->dirty = true;
 	strncpy(data->text, "#", 255);
 	TM_AddDelay(data->timeline, 0.3);
 	TM_AddQueuedBackgroundAction(data->timeline, FadeIn, NULL, 0);
@@ -157,6 +177,7 @@ void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 }
 
 void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data, ALLEGRO_EVENT* ev) {
+	TRACE_SCOPE("dosowisko ProcessEvent");
 	if (((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_ESCAPE)) || (ev->type == ALLEGRO_EVENT_TOUCH_END) || (ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP)) {
 		UnloadAllGamestates(game);
 		StartGamestate(game, SKIP_GAMESTATE);
@@ -164,6 +185,8 @@ void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data,
 }
 
 void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
+	TRACE_LOAD_SCOPE("dosowisko Load");
+	progress = TraceProgress("dosowisko", progress);
 	struct GamestateResources* data = malloc(sizeof(struct GamestateResources));
 	int flags = al_get_new_bitmap_flags();
 	al_set_new_bitmap_flags(flags & ~ALLEGRO_MAG_LINEAR);
@@ -174,23 +197,23 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	data->checkerboard = al_create_bitmap(320, 180);
 	(*progress)(game);
 
-	data->font = al_load_ttf_font(GetDataFilePath(game, "fonts/DejaVuSansMono.ttf"),
+	data->font = TRACE_LOAD(al_load_ttf_font, GetDataFilePath(game, "fonts/DejaVuSansMono.ttf"),
 		(int)(180 * 0.1666 / 8) * 8, 0);
 	(*progress)(game);
 
-	data->sample = al_load_sample(GetDataFilePath(game, "dosowisko.flac"));
+	data->sample = TRACE_LOAD(al_load_sample, GetDataFilePath(game, "dosowisko.flac"));
 	data->sound = al_create_sample_instance(data->sample);
 	al_attach_sample_instance_to_mixer(data->sound, game->audio.music);
 	al_set_sample_instance_playmode(data->sound, ALLEGRO_PLAYMODE_ONCE);
 	(*progress)(game);
 
-	data->kbd_sample = al_load_sample(GetDataFilePath(game, "kbd.flac"));
+	data->kbd_sample = TRACE_LOAD(al_load_sample, GetDataFilePath(game, "kbd.flac"));
 	data->kbd = al_create_sample_instance(data->kbd_sample);
 	al_attach_sample_instance_to_mixer(data->kbd, game->audio.fx);
 	al_set_sample_instance_playmode(data->kbd, ALLEGRO_PLAYMODE_ONCE);
 	(*progress)(game);
 
-	data->key_sample = al_load_sample(GetDataFilePath(game, "key.flac"));
+	data->key_sample = TRACE_LOAD(al_load_sample, GetDataFilePath(game, "key.flac"));
 	data->key = al_create_sample_instance(data->key_sample);
 	al_attach_sample_instance_to_mixer(data->key, game->audio.fx);
 	al_set_sample_instance_playmode(data->key, ALLEGRO_PLAYMODE_ONCE);
@@ -202,6 +225,7 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 }
 
 void Gamestate_PostLoad(struct Game* game, struct GamestateResources* data) {
+	TRACE_SCOPE("dosowisko PostLoad");
 	al_set_target_bitmap(data->checkerboard);
 	al_lock_bitmap(data->checkerboard, ALLEGRO_PIXEL_FORMAT_ANY, ALLEGRO_LOCK_WRITEONLY);
 	int x, y;
@@ -244,4 +268,5 @@ void Gamestate_Reload(struct Game* game, struct GamestateResources* data) {
 	data->bitmap = CreateNotPreservedBitmap(320, 180);
 	data->pixelator = CreateNotPreservedBitmap(320, 180);
 	al_set_new_bitmap_flags(flags);
+	data->dirty = true;
 }
@@ -19,65 +19,436 @@
  */
 
 #include "../common.h"
+#include "../analysis.h"
+#include "../atlas.h"
+#include "../benchmark.h"
+#include "../choir.h"
+#include "../compressed.h"
+#include "../deadline.h"
+#include "../engine.h"
+#include "../hittest.h"
+#include "../layer.h"
+#include "../loader.h"
+#include "../loop.h"
+#include "../mixdown.h"
+#include "../resample.h"
+#include "../scheduler.h"
+#include "../sendbus.h"
+#include "../soundbank.h"
+#include "../spritebatch.h"
+#include "../submix.h"
+#include "../trace.h"
+#include "../transport.h"
 #include <libsuperderpy.h>
 
 struct GamestateResources {
 	// This struct is for every resource allocated and used by your gamestate.
 	// It gets created on load and then gets passed around to all other function calls.
 
-	struct Character *pyry[8], *buzie[8], *buzia;
-	int mode[8];
-	int hovered;
-	double timer;
+	struct Choir* choir;
+	bool stress;
+	int arranged; // potatoes singing as requested by the benchmark
 
+	// Per-potato state, indexed like the choir.
+	struct Character **pyry, **buzie;
+	int* mode;
 	struct Frame {
+		// written by the renderer only
 		int frame;
-		int potato;
 		bool alternative;
-	} frame[8];
 
-	ALLEGRO_SAMPLE* sample[8][5];
-	ALLEGRO_SAMPLE_INSTANCE* song[8][5];
+		// owned by the audio thread, shared through the channel
+		struct Analysis analysis;
+		struct AnalysisChannel channel;
+		struct Transport* transport;
+		struct DeadlineMonitor* monitor;
+		struct SendBus* bus;
+		float send;
+		int index;
+	}* frame;
+	ALLEGRO_MIXER** mixer;
+	struct Loop* loop; // CHOIR_MODES per potato
+	int* live; // which of the potato's two decks plays its mode; -1 for none
+	int* sung; // mode the decks have been switched to; lags behind `mode` while a switch waits for a deck
+	struct Switch {
+		enum Quantum quantum;
+		double time; // of the input
+	}* request; // the switch to `mode`
+	ALLEGRO_TRANSFORM* placement; // potato bitmap to stage, as last drawn
 
-	ALLEGRO_MIXER* mixer[8];
+	int hovered;
+	bool hover; // pointer has moved since the last frame
+	double timer;
+	struct HitMask** mask; // per sprite
+	struct HitGrid* grid;
+
+	struct Character **potato, *buzia; // spritesheet owners, shared by the whole choir
+	ALLEGRO_SAMPLE** sample; // CHOIR_MODES per voice, shared by every potato singing it
+	struct CompressedSample** compressed; // CHOIR_MODES per voice, when streaming from memory
+	atomic_int* state; // enum SampleState of every sample
+	struct Loader* prefetch; // loads samples in the background in lazy mode
+	struct SoundBank* bank;
+	struct Transport* transport;
+	struct DeadlineMonitor* monitor;
+	struct Scheduler* scheduler; // two decks per potato
+	struct SendBus* bus; // room reverb shared by the whole choir; NULL when disabled
+	struct Engine* engine; // mixes the choir instead of the mixers, decks and sample instances when set
+	float** pcm; // CHOIR_MODES per voice, converted for the engine
+	struct Resampler* resampler; // from the loops' rate to the mixing rate; NULL when they match
+	unsigned int length; // of the loops as played, in frames of the transport's rate
+	enum Quantum quantum; // of switches made by clicking
 
 	ALLEGRO_BITMAP *scene, *light, *mic;
+	ALLEGRO_BITMAP** mics; // per potato, shrunk to the size it's drawn at; shared by potatoes with the same size
+	struct Atlas* atlas;
+	struct SpriteBatch* batch;
+	struct Layer* layer; // the scene, cached at the resolution of the screen
 
 	ALLEGRO_FONT* font;
 };
 
 int Gamestate_ProgressCount = 71; // number of loading steps as reported by Gamestate_Load; 0 when missing
 
+// How much there is to load depends on the scene, but the engine needs to know the step count upfront,
+// so Gamestate_Load counts its own steps and rescales them. Only touched from the loading thread.
+static struct {
+	void (*progress)(struct Game*);
+	int steps, done, reported;
+} loading;
+
+static void Progress(struct Game* game) {
+	TraceLoadStep();
+	loading.done++;
+	while (loading.reported < Gamestate_ProgressCount && loading.reported < (long)loading.done * Gamestate_ProgressCount / loading.steps) {
+		loading.reported++;
+		loading.progress(game);
+	}
+}
+
+#define MOUTH_GAIN 40.0 // matches how wide mouths used to open with 1024 frame buffers
+#define MOUTH_BRIGHTNESS 0.1 // share of energy above 1 kHz that switches to the alternative mouth shapes
+#define HOVER_MARGIN 0.1 // how far singing can move a potato out of its resting place, relative to its size
+
+#if defined(__EMSCRIPTEN__) || defined(__vita__)
+#define COMPRESSED_DEFAULT "1" // short on memory, with slow or no disk to stream from
+#else
+#define COMPRESSED_DEFAULT "0"
+#endif
+
+static void AnalyzePotato(void* buffer, unsigned int samples, void* userdata) {
+	// The engine calls it from whichever thread rendered the potato, and times the potato by itself.
+	struct Frame* frame = userdata;
+	AnalyzeBlock(&frame->analysis, buffer, samples);
+	PublishAnalysis(&frame->channel, &frame->analysis, atomic_load_explicit(&frame->transport->frames, memory_order_relaxed));
+}
+
 static void MixerPostprocess(void* buffer, unsigned int samples, void* userdata) {
 	struct Frame* frame = userdata;
-	float* buf = buffer;
-	float sum = 0.0;
-	for (unsigned int i = 0; i < samples; i += 2) {
-		sum += fabsf(buf[i]);
+	AnalyzePotato(buffer, samples, userdata);
+	if (frame->bus) {
+		SendToBus(frame->bus, buffer, samples, 0, frame->send);
+	}
+	MarkDeadlineStage(frame->monitor, frame->index);
+}
+
+static void UpdateMouth(struct Frame* frame) {
+	// Called once per rendered frame, so the mouth never changes more often than it can be seen.
+	struct AnalysisSnapshot snapshot;
+	ReadAnalysis(&frame->channel, &snapshot);
+
+	int open = pow(snapshot.rms * MOUTH_GAIN, 2);
+	if (open > 3) {
+		open = 3;
+	}
+	frame->frame = 3 - open;
+
+	float total = 0.0;
+	for (int i = 0; i < ANALYSIS_BANDS; i++) {
+		total += snapshot.bands[i];
+	}
+	frame->alternative = total > 0.0 && (snapshot.bands[2] + snapshot.bands[3]) / total > MOUTH_BRIGHTNESS;
+}
+
+// In lazy mode, samples get loaded only once some potato is about to sing them.
+enum SampleState {
+	SAMPLE_MISSING,
+	SAMPLE_QUEUED,
+	SAMPLE_LOADED, // by the prefetcher, but not handed to the loops yet
+	SAMPLE_READY,
+};
+
+struct SampleJob {
+	ALLEGRO_SAMPLE** sample;
+	char* path;
+	atomic_int* state; // NULL when loading up front
+	struct Resampler* resampler; // optional
+};
+
+static void LoadSampleJob(struct Game* game, void* arg) {
+	// Without a path, the sample is already there and only gets resampled.
+	struct SampleJob* job = arg;
+	ALLEGRO_SAMPLE* sample = job->path ? LoadLoopSample(game, job->path, LOOP_LENGTH) : *job->sample;
+	if (sample && job->resampler) {
+		TRACE_SCOPE_DETAIL("ResampleLoopSample", job->path);
+		ALLEGRO_SAMPLE* resampled = ResampleLoopSample(job->resampler, sample, LOOP_LENGTH);
+		if (!resampled) {
+			PrintConsole(game, "Could not resample %s", job->path ? job->path : "a sound bank loop");
+		}
+		al_destroy_sample(sample);
+		sample = resampled;
+	}
+	*job->sample = sample;
+	if (job->state) {
+		atomic_store_explicit(job->state, SAMPLE_LOADED, memory_order_release);
+	}
+	free(job->path);
+}
+
+struct CompressedJob {
+	struct CompressedSample** sample;
+	char* path;
+};
+
+static void LoadCompressedJob(struct Game* game, void* arg) {
+	struct CompressedJob* job = arg;
+	TRACE_SCOPE_DETAIL("LoadCompressedSample", job->path);
+	*job->sample = LoadCompressedSample(job->path);
+	if (!*job->sample) {
+		PrintConsole(game, "Could not read %s", job->path);
+	}
+	free(job->path);
+}
+
+static inline struct Loop* GetLoop(struct GamestateResources* data, int potato, int mode) {
+	return &data->loop[potato * CHOIR_MODES + mode];
+}
+
+static void RequestSample(struct GamestateResources* data, int i, int mode) {
+	int index = data->choir->voice[i] * CHOIR_MODES + mode;
+	if (!data->prefetch || atomic_load_explicit(&data->state[index], memory_order_relaxed) != SAMPLE_MISSING) {
+		return;
+	}
+	atomic_store_explicit(&data->state[index], SAMPLE_QUEUED, memory_order_relaxed);
+	struct SampleJob job = {.sample = &data->sample[index], .path = strdup(GetLoop(data, i, mode)->path), .state = &data->state[index], .resampler = data->resampler};
+	AddLoaderJob(data->prefetch, LoadSampleJob, &job, sizeof(job));
+}
+
+static inline struct Deck* GetDeck(struct GamestateResources* data, int potato, int deck) {
+	return &data->scheduler->decks[potato * 2 + deck];
+}
+
+static void AttachDeck(struct GamestateResources* data, struct Deck* deck, struct Loop* loop) {
+	deck->loop = loop;
+	if (data->engine) {
+		int index = loop - data->loop;
+		SetEngineDeck(data->engine, deck - data->scheduler->decks, data->pcm[data->choir->voice[index / CHOIR_MODES] * CHOIR_MODES + index % CHOIR_MODES]);
+		return;
 	}
-	sum = pow(sum / 10.0, 2);
-	frame->frame = sum;
-	if (frame->frame > 3) {
-		frame->frame = 3;
+	loop->mixer = deck->mixer;
+	SetLoopActive(data->transport, loop, true);
+}
+
+static void DetachDeck(struct GamestateResources* data, struct Deck* deck) {
+	if (!deck->loop) {
+		return;
 	}
-	frame->frame = 3 - frame->frame;
-	if (frame->frame == 0) {
-		frame->alternative = !frame->alternative;
+	if (data->engine) {
+		SetEngineDeck(data->engine, deck - data->scheduler->decks, NULL);
+	} else {
+		SetLoopActive(data->transport, deck->loop, false);
+	}
+	deck->loop = NULL;
+}
+
+static void ConvertEngineSample(struct GamestateResources* data, int v) {
+	// The engine mixes floats, so the decoded sample isn't needed anymore.
+	data->pcm[v] = ConvertMixdownData(data->sample[v], data->length);
+	al_destroy_sample(data->sample[v]);
+	data->sample[v] = NULL;
+}
+
+static void UpdateSamples(struct GamestateResources* data) {
+	// Loops that were activated before their sample got loaded join in at the transport's position.
+	for (int v = 0; v < data->choir->voices * CHOIR_MODES; v++) {
+		if (atomic_load_explicit(&data->state[v], memory_order_acquire) != SAMPLE_LOADED) {
+			continue;
+		}
+		atomic_store_explicit(&data->state[v], SAMPLE_READY, memory_order_relaxed);
+		if (!data->sample[v]) {
+			continue;
+		}
+		if (data->engine) {
+			ConvertEngineSample(data, v);
+		}
+		for (int i = 0; i < data->choir->count; i++) {
+			if (data->choir->voice[i] != v / CHOIR_MODES) {
+				continue;
+			}
+			struct Loop* loop = GetLoop(data, i, v % CHOIR_MODES);
+			if (!data->engine) {
+				SetLoopSample(data->transport, loop, data->sample[v], data->length);
+				continue;
+			}
+			for (int k = 0; k < 2; k++) {
+				if (GetDeck(data, i, k)->loop == loop) {
+					AttachDeck(data, GetDeck(data, i, k), loop);
+				}
+			}
+		}
+	}
+}
+
+static bool SwitchDecks(struct GamestateResources* data, int i) {
+	// The new loop starts playing silently in sync on the other deck right away; the audio thread
+	// then swaps the decks' gains at the exact frame of the chosen quantum. Loops only ever get
+	// detached from decks the audio thread reported silent after taking every command for them,
+	// so whenever that's not possible yet, this returns false and Logic tries again on the next frame.
+	int mode = data->mode[i];
+	if (data->sung[i] == mode) {
+		return true;
+	}
+	struct Deck* decks[2] = {GetDeck(data, i, 0), GetDeck(data, i, 1)};
+	enum DeckState state[2] = {GetDeckState(decks[0]), GetDeckState(decks[1])};
+	if (state[0] == DECK_PENDING || state[1] == DECK_PENDING || IsSchedulerFull(data->scheduler)) {
+		return false; // one switch per potato in flight, so the queue only fills up with more potatoes than decks
+	}
+
+	int out = data->live[i];
+	if (out >= 0 && state[out] == DECK_SILENT) {
+		// The last switch got cancelled, so the other deck kept playing whatever it played.
+		int other = 1 - out;
+		out = decks[other]->loop && state[other] != DECK_SILENT ? other : -1;
+		data->live[i] = out;
+		data->sung[i] = out >= 0 ? decks[out]->loop - GetLoop(data, i, 0) : -1;
+		if (data->sung[i] == mode) {
+			return true;
+		}
+	}
+
+	int in = -1;
+	if (mode >= 0) {
+		struct Loop* loop = GetLoop(data, i, mode);
+		for (int k = 0; k < 2; k++) {
+			if (decks[k]->loop == loop) {
+				in = k; // still fading out, it gets faded back in
+			}
+		}
+		if (in < 0 && out >= 0 && state[out] == DECK_WAITING) {
+			// The previous switch hasn't reached its boundary yet, so it gets called off, which
+			// frees its deck for this one. If it got there first after all, this waits for it to land.
+			CancelSchedulerSwitch(data->scheduler, i * 2 + out, i * 2 + 1 - out); // checked above
+			return false;
+		}
+		if (in < 0) {
+			if (out >= 0 && state[out] == DECK_FADING) {
+				return false;
+			}
+			for (int k = 0; k < 2; k++) {
+				if (k != out && (!decks[k]->loop || state[k] == DECK_SILENT)) {
+					in = k;
+					break;
+				}
+			}
+			if (in < 0) {
+				return false;
+			}
+			DetachDeck(data, decks[in]);
+			AttachDeck(data, decks[in], loop);
+		}
+	}
+	if (in >= 0 || out >= 0) {
+		PostSchedulerCommand(data->scheduler, in >= 0 ? i * 2 + in : -1, out >= 0 ? i * 2 + out : -1, data->request[i].quantum, data->request[i].time); // checked above
+	}
+	data->live[i] = in;
+	data->sung[i] = mode;
+	return true;
+}
+
+static void SetPotatoMode(struct GamestateResources* data, int i, int mode, enum Quantum quantum, double time) {
+	if (data->mode[i] == mode) {
+		return;
+	}
+	data->mode[i] = mode;
+	data->request[i] = (struct Switch){.quantum = quantum, .time = time};
+	if (mode >= 0) {
+		RequestSample(data, i, mode);
+	}
+	SwitchDecks(data, i);
+
+	// Clicking cycles through the modes, so the next one is known in advance.
+	int next = mode + 1 < CHOIR_MODES ? mode + 1 : -1;
+	if (next >= 0) {
+		RequestSample(data, i, next);
+	}
+}
+
+static void UpdatePlacement(struct Game* game, struct GamestateResources* data, int i, const ALLEGRO_TRANSFORM* transform) {
+	// Same geometry as AddCenteredSprite, so hit testing follows what's on the screen.
+	ALLEGRO_BITMAP* bitmap = data->pyry[i]->frame->bitmap;
+	ALLEGRO_TRANSFORM* placement = &data->placement[i];
+	al_identity_transform(placement);
+	al_translate_transform(placement, -al_get_bitmap_width(bitmap) / 2.0, -al_get_bitmap_height(bitmap) / 2.0);
+	al_scale_transform(placement, data->pyry[i]->scaleX, data->pyry[i]->scaleY);
+	if (transform) {
+		al_compose_transform(placement, transform);
+	} else {
+		al_translate_transform(placement, GetCharacterX(game, data->pyry[i]), GetCharacterY(game, data->pyry[i]));
 	}
-	//printf("potato %d sum %f\n", frame->potato, sum);
 }
 
 static void UpdateHover(struct Game* game, struct GamestateResources* data) {
+	// Only potatoes whose resting bounds cover the pointer's grid cell are tested. Cells list them
+	// in drawing order, so the first hit from the end is the visible one.
+	float x = game->data->mouseX * game->viewport.width, y = game->data->mouseY * game->viewport.height;
+	const int* candidates;
+	int count = GetHitGridItems(data->grid, x, y, &candidates);
+
 	data->hovered = -1;
-	for (int i = 0; i < 8; i++) {
-		if (IsOnCharacter(game, data->pyry[i], game->data->mouseX * game->viewport.width, game->data->mouseY * game->viewport.height, true)) {
+	for (int j = count - 1; j >= 0; j--) {
+		int i = candidates[j];
+		ALLEGRO_TRANSFORM inverse = data->placement[i];
+		al_invert_transform(&inverse);
+		float px = x, py = y;
+		al_transform_coordinates(&inverse, &px, &py);
+
+		struct HitMask* mask = data->mask[data->choir->sprite[i]];
+		if (mask ? TestHitMask(mask, px, py) : IsOnCharacter(game, data->pyry[i], x, y, true)) {
 			data->hovered = i;
+			break;
 		}
 	}
 }
 
 void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double delta) {
 	// Here you should do all your game logic as if <delta> seconds have passed.
+	TRACE_SCOPE("game Logic");
+	UpdateDeadlineMonitor(game, data->monitor);
+	if (data->prefetch) {
+		UpdateSamples(data);
+	}
+
+	// Loops that have faded out stop being mixed, and switches that had to wait for them go on.
+	for (int i = 0; i < data->choir->count; i++) {
+		for (int k = 0; k < 2; k++) {
+			struct Deck* deck = GetDeck(data, i, k);
+			if (k != data->live[i] && deck->loop && GetDeckState(deck) == DECK_SILENT) {
+				DetachDeck(data, deck);
+			}
+		}
+		if (data->sung[i] != data->mode[i]) {
+			SwitchDecks(data, i);
+		}
+	}
+
+	struct Benchmark* benchmark = game->data->benchmark;
+	if (benchmark && benchmark->singing != data->arranged) {
+		// the first potatoes of the choir sing, the rest stays silent
+		data->arranged = benchmark->singing;
+		for (int i = 0; i < data->choir->count; i++) {
+			SetPotatoMode(data, i, i < data->arranged ? i % CHOIR_MODES : -1, QUANTUM_NONE, al_get_time());
+		}
+	}
+
 	if (data->timer > 0) {
 		data->timer -= delta;
 		if (data->timer <= 0) {
@@ -86,84 +457,67 @@ void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double
 	}
 }
 
+static void DrawStaticLayer(struct Game* game, void* userdata) {
+	// Only the scene is static: the lights sway behind it and the mics stand in between the potatoes.
+	struct GamestateResources* data = userdata;
+	al_draw_bitmap(data->scene, 0, 0, 0);
+}
+
 void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 	// Draw everything to the screen here.
+	TRACE_SCOPE("game Draw");
 
-	float time = al_get_sample_instance_position(data->song[0][0]) / (float)al_get_sample_instance_length(data->song[0][0]) * 8;
+	// Startup ends with the first frame of the choir, the intros included.
+	if (game->data->startup) {
+		AddTraceEvent("startup", NULL, game->data->startup, al_get_time());
+		game->data->startup = 0;
+	}
 
-	al_draw_rotated_bitmap(data->light, 0, 0, 445, 160, cos(al_get_time() * ALLEGRO_PI / 2.0) / 32.0, ALLEGRO_FLIP_HORIZONTAL);
-	al_draw_rotated_bitmap(data->light, al_get_bitmap_width(data->light), 0, 1640, 160, sin(al_get_time() * ALLEGRO_PI / 2.0) / 32.0, 0);
-	al_draw_bitmap(data->scene, 0, 0, 0);
+	float time = GetTransportBeat(data->transport);
+
+	// Everything but the scene comes from the atlas. Per-potato transforms are applied on the CPU,
+	// so the whole choir goes out in a single primitive draw.
+	struct SpriteBatch* batch = data->batch;
+	ALLEGRO_COLOR white = al_map_rgb(255, 255, 255);
+
+	// The swaying lights shine from behind the scene, which is copied 1:1 from its cached layer.
+	ALLEGRO_BITMAP* light = GetAtlasBitmap(data->atlas, data->light);
+	AddSprite(batch, light, white, 0, 0, 445, 160, 1, 1, cos(al_get_time() * ALLEGRO_PI / 2.0) / 32.0, ALLEGRO_FLIP_HORIZONTAL, NULL);
+	AddSprite(batch, light, white, al_get_bitmap_width(light), 0, 1640, 160, 1, 1, sin(al_get_time() * ALLEGRO_PI / 2.0) / 32.0, 0, NULL);
+	NoteSpriteBatchDraw(batch, data->layer->bitmap);
+	DrawLayer(game, data->layer);
+
+	ALLEGRO_TRANSFORM transform;
+
+	struct Choir* choir = data->choir;
+	for (int i = 0; i < choir->count; i++) {
+		UpdateMouth(&data->frame[i]);
+	}
 
-	ALLEGRO_TRANSFORM transform, orig = *al_get_current_transform();
+	// Pointer motion is only tracked once per frame, against the placement that's on the screen.
+	if (data->hover) {
+		UpdateHover(game, data);
+		data->hover = false;
+	}
 
 	//PrintConsole(game, "%f", time);
 
-	for (int i = 0; i < 8; i++) {
-		float facescale = 0.9;
-		if (i < 4) {
-			facescale = 0.75;
-		}
-
-		int foffsetx, foffsety;
-		bool fflip = false;
-		switch (i) {
-			case 0:
-				foffsetx = 0;
-				foffsety = 15;
-				break;
-			case 1:
-				foffsetx = 40;
-				foffsety = 25;
-				break;
-			case 2:
-				foffsetx = 20;
-				foffsety = 10;
-				break;
-			case 3:
-				foffsetx = 10;
-				foffsety = 30;
-				break;
-			case 4:
-				foffsetx = 5;
-				foffsety = 5;
-				break;
-			case 5:
-				foffsetx = -45;
-				foffsety = 25;
-				fflip = true;
-				break;
-			case 6:
-				foffsetx = 20;
-				foffsety = 60;
-				break;
-			case 7:
-				foffsetx = 10;
-				foffsety = 50;
-				fflip = true;
-				break;
-			default:
-				foffsetx = 0;
-				foffsety = 0;
-				break;
-		}
+	for (int i = 0; i < choir->count; i++) {
+		int fflip = choir->face_flip[i] ? ALLEGRO_FLIP_HORIZONTAL : 0;
 
 		data->pyry[i]->tint = i == data->hovered ? al_map_rgb_f(2, 2, 2) : al_map_rgb(255, 255, 255);
 
 		data->pyry[i]->spritesheet->pivotX = 0.5;
 		data->pyry[i]->spritesheet->pivotY = 0.5;
 
+		ALLEGRO_BITMAP* pyra = GetAtlasBitmap(data->atlas, data->pyry[i]->frame->bitmap);
+
 		if (data->mode[i] >= 0) {
 			al_identity_transform(&transform);
 
-			int x = i;
-			if (x > 3) {
-				x--;
-			}
-
 			al_translate_transform(&transform, -al_get_bitmap_width(data->pyry[i]->frame->bitmap) / 2.0, -al_get_bitmap_height(data->pyry[i]->frame->bitmap) / 2.0);
 			//al_scale_transform(&transform, data->pyry[i]->scaleX, data->pyry[i]->scaleY);
-			al_horizontal_shear_transform(&transform, sin(time * ALLEGRO_PI + ALLEGRO_PI * x + 0.075 * i) * 0.05);
+			al_horizontal_shear_transform(&transform, sin(time * ALLEGRO_PI + ALLEGRO_PI * choir->sway[i] + 0.075 * i) * 0.05);
 			al_translate_transform(&transform, al_get_bitmap_width(data->pyry[i]->frame->bitmap) / 2.0, al_get_bitmap_height(data->pyry[i]->frame->bitmap) / 2.0);
 
 			al_translate_transform(&transform, 0, -al_get_bitmap_height(data->pyry[i]->frame->bitmap));
@@ -172,76 +526,39 @@ void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 
 			al_translate_transform(&transform, GetCharacterX(game, data->pyry[i]), GetCharacterY(game, data->pyry[i]));
 
-			al_compose_transform(&transform, &orig);
-			al_use_transform(&transform);
-
-			DrawCenteredTintedScaled(data->pyry[i]->frame->bitmap, data->pyry[i]->tint, 0, 0, data->pyry[i]->scaleX, data->pyry[i]->scaleY, 0);
+			AddCenteredSprite(batch, pyra, data->pyry[i]->tint, 0, 0, data->pyry[i]->scaleX, data->pyry[i]->scaleY, 0, &transform);
+			UpdatePlacement(game, data, i, &transform);
 			ALLEGRO_BITMAP* buzia = data->buzie[i]->spritesheets->frames[data->frame[i].frame].bitmap;
 			if (data->frame[i].alternative) {
 				buzia = data->buzie[i]->spritesheets->next->frames[data->frame[i].frame].bitmap;
 			}
-			DrawCenteredScaled(buzia, foffsetx, foffsety, facescale, facescale, fflip ? ALLEGRO_FLIP_HORIZONTAL : 0);
-
-			al_use_transform(&orig);
+			AddCenteredSprite(batch, GetAtlasBitmap(data->atlas, buzia), white, choir->face_x[i], choir->face_y[i], choir->face_scale[i], choir->face_scale[i], fflip, &transform);
 		} else {
-			al_use_transform(&orig);
-			DrawCharacter(game, data->pyry[i]);
-			DrawCenteredScaled(data->buzie[i]->frame->bitmap, GetCharacterX(game, data->pyry[i]) + foffsetx, GetCharacterY(game, data->pyry[i]) + foffsety, facescale, facescale, fflip ? ALLEGRO_FLIP_HORIZONTAL : 0);
-		}
-
-		int offsetx, offsety;
-		bool flip = false;
-		switch (i) {
-			case 0:
-				offsetx = 80;
-				offsety = 40;
-				break;
-			case 1:
-				offsetx = 100;
-				offsety = 100;
-				break;
-			case 2:
-				offsetx = 90;
-				offsety = 60;
-				break;
-			case 3:
-				offsetx = 55;
-				offsety = 100;
-				break;
-			case 4:
-				offsetx = 80;
-				offsety = 110;
-				break;
-			case 5:
-				offsetx = -90;
-				offsety = 80;
-				flip = true;
-				break;
-			case 6:
-				offsetx = 75;
-				offsety = 90;
-				break;
-			case 7:
-				offsetx = -60;
-				offsety = 80;
-				flip = true;
-				break;
-			default:
-				offsetx = 0;
-				offsety = 0;
-				break;
-		}
-
-		DrawCenteredScaled(data->mic, GetCharacterX(game, data->pyry[i]) + offsetx, GetCharacterY(game, data->pyry[i]) + offsety, 0.2, 0.2, flip ? ALLEGRO_FLIP_HORIZONTAL : 0);
-	}
-
-	al_use_transform(&orig);
-
-	for (int i = 0; i < 8; i++) {
-		if (data->mode[i] >= 0 && data->hovered == i) {
-			al_draw_text(data->font, al_map_rgb(255, 255, 255), (game->data->mouseX + 0.02) * game->viewport.width + 3, (game->data->mouseY + 0.02) * game->viewport.height + 3, ALLEGRO_ALIGN_LEFT, PunchNumber(game, "X", 'X', data->mode[i] + 1));
-			al_draw_text(data->font, al_map_rgb(0, 0, 0), (game->data->mouseX + 0.02) * game->viewport.width, (game->data->mouseY + 0.02) * game->viewport.height, ALLEGRO_ALIGN_LEFT, PunchNumber(game, "X", 'X', data->mode[i] + 1));
+			AddCenteredSprite(batch, pyra, data->pyry[i]->tint, GetCharacterX(game, data->pyry[i]), GetCharacterY(game, data->pyry[i]), data->pyry[i]->scaleX, data->pyry[i]->scaleY, 0, NULL);
+			UpdatePlacement(game, data, i, NULL);
+			AddCenteredSprite(batch, GetAtlasBitmap(data->atlas, data->buzie[i]->frame->bitmap), white, GetCharacterX(game, data->pyry[i]) + choir->face_x[i], GetCharacterY(game, data->pyry[i]) + choir->face_y[i], choir->face_scale[i], choir->face_scale[i], fflip, NULL);
 		}
+
+		// Mics stand in front of their potatoes and behind the next ones, so they can't be baked into the layer.
+		float mic_sx = choir->mic_scale[i] * al_get_bitmap_width(data->mic) / al_get_bitmap_width(data->mics[i]);
+		float mic_sy = choir->mic_scale[i] * al_get_bitmap_height(data->mic) / al_get_bitmap_height(data->mics[i]);
+		AddCenteredSprite(batch, GetAtlasBitmap(data->atlas, data->mics[i]), white, GetCharacterX(game, data->pyry[i]) + choir->mic_x[i], GetCharacterY(game, data->pyry[i]) + choir->mic_y[i], mic_sx, mic_sy, choir->mic_flip[i] ? ALLEGRO_FLIP_HORIZONTAL : 0, NULL);
+	}
+
+	FlushSpriteBatch(batch);
+	if (game->data->benchmark) {
+		CountBenchmarkDraws(game->data->benchmark, batch->draws, batch->binds);
+		batch->draws = 0;
+		batch->binds = 0;
+
+		struct DeadlineStats stats;
+		ReadDeadlineStats(data->monitor, &stats, NULL);
+		SetBenchmarkAudio(game->data->benchmark, stats.cost_total, stats.blocks * stats.period);
+	}
+
+	if (data->hovered >= 0 && data->mode[data->hovered] >= 0) {
+		al_draw_text(data->font, al_map_rgb(255, 255, 255), (game->data->mouseX + 0.02) * game->viewport.width + 3, (game->data->mouseY + 0.02) * game->viewport.height + 3, ALLEGRO_ALIGN_LEFT, PunchNumber(game, "X", 'X', data->mode[data->hovered] + 1));
+		al_draw_text(data->font, al_map_rgb(0, 0, 0), (game->data->mouseX + 0.02) * game->viewport.width, (game->data->mouseY + 0.02) * game->viewport.height, ALLEGRO_ALIGN_LEFT, PunchNumber(game, "X", 'X', data->mode[data->hovered] + 1));
 	}
 
 	if (game->config.mute) {
@@ -262,14 +579,14 @@ void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data, ALLEGRO_EVENT* ev) {
 	// Called for each event in Allegro event queue.
 	// Here you can handle user input, expiring timers etc.
+	TRACE_SCOPE("game ProcessEvent");
 	if ((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_ESCAPE)) {
 		UnloadCurrentGamestate(game); // mark this gamestate to be stopped and unloaded
 		// When there are no active gamestates, the engine will quit.
 	}
 
 	if (ev->type == ALLEGRO_EVENT_TOUCH_BEGIN && !ev->touch.primary && data->hovered != -1 && data->mode[data->hovered] != -1) {
-		al_set_sample_instance_gain(data->song[data->hovered][data->mode[data->hovered]], 0.0);
-		data->mode[data->hovered] = -1;
+		SetPotatoMode(data, data->hovered, -1, data->quantum, ev->any.timestamp);
 		data->hovered = -1;
 		return;
 	}
@@ -277,8 +594,13 @@ void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data,
 	if (ev->type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN || ev->type == ALLEGRO_EVENT_MOUSE_AXES) {
 		game->data->mouseX = Clamp(0, 1, (ev->mouse.x - game->clip_rect.x) / (double)game->clip_rect.w);
 		game->data->mouseY = Clamp(0, 1, (ev->mouse.y - game->clip_rect.y) / (double)game->clip_rect.h);
-		UpdateHover(game, data);
 		data->timer = 0;
+		// Motion gets coalesced until the next frame; clicks need to know what they hit right away.
+		if (ev->type == ALLEGRO_EVENT_MOUSE_AXES) {
+			data->hover = true;
+		} else {
+			UpdateHover(game, data);
+		}
 	}
 	if (ev->type == ALLEGRO_EVENT_TOUCH_BEGIN) {
 		game->data->mouseX = Clamp(0, 1, (ev->touch.x - game->clip_rect.x) / (double)game->clip_rect.w);
@@ -303,22 +625,16 @@ void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data,
 
 	if (ev->type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN || ev->type == ALLEGRO_EVENT_TOUCH_BEGIN) {
 		if (data->hovered >= 0) {
-			if (data->mode[data->hovered] >= 0) {
-				al_set_sample_instance_gain(data->song[data->hovered][data->mode[data->hovered]], 0.0);
-			}
-
-			data->mode[data->hovered]++;
-			if (data->mode[data->hovered] > 4) {
-				data->mode[data->hovered] = -1;
+			int mode = data->mode[data->hovered] + 1;
+			if (mode >= CHOIR_MODES) {
+				mode = -1;
 			}
 
 			if (ev->type == ALLEGRO_EVENT_MOUSE_BUTTON_DOWN && ev->mouse.button > 1) {
-				data->mode[data->hovered] = -1;
+				mode = -1;
 			}
 
-			if (data->mode[data->hovered] >= 0) {
-				al_set_sample_instance_gain(data->song[data->hovered][data->mode[data->hovered]], 1.0);
-			}
+			SetPotatoMode(data, data->hovered, mode, data->quantum, ev->any.timestamp);
 
 			PrintConsole(game, "potato %d: sound %d", data->hovered, data->mode[data->hovered]);
 		}
@@ -331,59 +647,255 @@ void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
 	//
 	// NOTE: There's no OpenGL context available here. If you want to prerender something,
 	// create VBOs, etc. do it in Gamestate_PostLoad.
+	TRACE_LOAD_SCOPE("game Load");
+	BeginTraceLoad("game");
 
 	struct GamestateResources* data = calloc(1, sizeof(struct GamestateResources));
 
-	data->scene = al_load_bitmap(GetDataFilePath(game, "scene.png"));
-	progress(game); // report that we progressed with the loading, so the engine can move a progress bar
+	// Streaming keeps only the loops that are currently being sung decoded in memory.
+	bool streaming = strtol(GetConfigOptionDefault(game, "potatoes", "streaming", "0"), NULL, 10);
+
+	// Compressed mode streams from encoded copies of the loops kept in memory instead of from disk,
+	// so only the voices being sung get decoded, and just a few fragments ahead at that.
+	bool compressed = strtol(GetConfigOptionDefault(game, "potatoes", "compressed", COMPRESSED_DEFAULT), NULL, 10);
+	streaming = streaming || compressed;
+
+	// The engine mixes the whole choir by itself, which needs the loops decoded up front or by the prefetcher.
+	bool engine = strtol(GetConfigOptionDefault(game, "potatoes", "engine", "0"), NULL, 10);
+	if (engine && streaming) {
+		PrintConsole(game, "The mixing engine doesn't stream, using the mixers instead");
+		engine = false;
+	}
+
+	// Lazy mode decodes only the first mode of every voice up front (lazy=1) or nothing at all (lazy=2);
+	// the rest gets loaded in the background once it's about to be sung.
+	int lazy = strtol(GetConfigOptionDefault(game, "potatoes", "lazy", "0"), NULL, 10);
+
+	// Stress mode fills the stage with the given number of potatoes, all of them singing.
+	int stress = strtol(GetConfigOptionDefault(game, "potatoes", "stress", "0"), NULL, 10);
+	data->stress = stress > 0;
+
+	const char* scene = GetDataFilePath(game, GetConfigOptionDefault(game, "potatoes", "scene", "choir.ini"));
+	data->choir = LoadChoir(game, scene, stress);
+	if (!data->choir) {
+		PrintConsole(game, "Could not load the choir from %s", scene);
+		free(data);
+		return NULL;
+	}
+	struct Choir* choir = data->choir;
+
+	loading.progress = progress;
+	loading.steps = 3 + 3 + choir->sprites + choir->voices * CHOIR_MODES + choir->count + 1;
+	loading.done = 0;
+	loading.reported = 0;
+
+	// When the build has cooked a sound bank, loops are mapped from it instead of being decoded.
+	// It's cooked into the build's data directory and gets next to the other data files on install.
+	char* bank = FindDataFilePath(game, "choir.bank");
+	if (!bank && !streaming) {
+		PrintConsole(game, "No sound bank installed, decoding the loops");
+	}
+	if (bank && !streaming) {
+		data->bank = LoadSoundBank(bank);
+		if (!data->bank) {
+			PrintConsole(game, "Invalid sound bank %s, falling back to decoding", bank);
+		}
+	}
 
-	data->light = al_load_bitmap(GetDataFilePath(game, "light.png"));
-	progress(game);
+	// Bitmaps and loops are decoded by a pool of worker threads, which report their progress
+	// through the loader; characters and mixers are set up here in the meantime.
+	struct Loader* loader = CreateLoader(game, Progress, 0);
+
+	LoadBitmapAsync(loader, &data->scene, GetDataFilePath(game, "scene.png"));
+	LoadBitmapAsync(loader, &data->light, GetDataFilePath(game, "light.png"));
+	LoadBitmapAsync(loader, &data->mic, GetDataFilePath(game, "mic.png"));
+
+	// Decoded loops get resampled to the mixing rate while they load, so playing them needs no rate conversion.
+	// The transport then counts in frames of the resampled loops.
+	unsigned int frequency = al_get_mixer_frequency(game->audio.music);
+	data->length = LOOP_LENGTH;
+	if (!streaming && frequency != LOOP_FREQUENCY && strtol(GetConfigOptionDefault(game, "potatoes", "resample", "1"), NULL, 10)) {
+		data->resampler = CreateResampler(LOOP_FREQUENCY, frequency);
+		data->length = GetResampledLength(data->resampler, LOOP_LENGTH);
+	}
+	data->transport = CreateTransport(game, game->audio.music, data->length, data->resampler ? frequency : LOOP_FREQUENCY, LOOP_BEATS, LOOP_BEATS_PER_BAR);
+
+	// Potatoes send into a single reverb, processed once per buffer after all of them got mixed.
+	// It gets timed as the stage after the last potato.
+	bool reverb = strtol(GetConfigOptionDefault(game, "potatoes", "reverb", "1"), NULL, 10);
+
+	// Has to come before the potato mixers get attached, so it gets mixed before them.
+	data->monitor = CreateDeadlineMonitor(game, data->transport->mixer, choir->count + (reverb ? 1 : 0));
+	SetTransportMonitor(data->transport, data->monitor);
+	if (reverb) {
+		data->bus = CreateSendBus(al_get_mixer_frequency(data->transport->mixer), choir->count);
+		SetTransportBus(data->transport, data->bus);
+	}
+	data->scheduler = CreateScheduler(game, data->transport, choir->count * 2);
+	if (engine) {
+		data->engine = CreateEngine(data->scheduler, data->bus, choir->count, GetSubmixThreads(game, choir->count));
+	}
 
-	data->mic = al_load_bitmap(GetDataFilePath(game, "mic.png"));
-	progress(game);
+	// Clicks switch loops right away (none), on the next beat or on the next bar.
+	data->quantum = ParseQuantum(GetConfigOptionDefault(game, "potatoes", "quantize", "none"));
+
+	// Every voice is decoded once, no matter how many potatoes sing it.
+	data->sample = calloc(choir->voices * CHOIR_MODES, sizeof(ALLEGRO_SAMPLE*));
+	data->state = calloc(choir->voices * CHOIR_MODES, sizeof(atomic_int));
+	if (compressed) {
+		data->compressed = calloc(choir->voices * CHOIR_MODES, sizeof(struct CompressedSample*));
+	}
+	if (lazy && !streaming && !data->bank) {
+		data->prefetch = CreateLoader(game, NULL, 1);
+	}
+	for (int i = 0; i < choir->voices; i++) {
+		for (int j = 0; j < CHOIR_MODES; j++) {
+			atomic_init(&data->state[i * CHOIR_MODES + j], SAMPLE_READY);
+			if (compressed) {
+				struct CompressedJob job = {
+					.sample = &data->compressed[i * CHOIR_MODES + j],
+					.path = strdup(GetDataFilePath(game, PunchNumber(game, PunchNumber(game, "pX/Y.flac", 'X', i), 'Y', j + 1))),
+				};
+				AddLoaderJob(loader, LoadCompressedJob, &job, sizeof(job));
+			} else if (streaming) {
+				Progress(game);
+			} else if (data->prefetch && (lazy > 1 || j > 0)) {
+				atomic_init(&data->state[i * CHOIR_MODES + j], SAMPLE_MISSING);
+				Progress(game);
+			} else if (data->bank) {
+				data->sample[i * CHOIR_MODES + j] = CreateSoundBankSample(data->bank, PunchNumber(game, PunchNumber(game, "pX/Y", 'X', i), 'Y', j + 1));
+				if (data->resampler && data->sample[i * CHOIR_MODES + j]) {
+					struct SampleJob job = {.sample = &data->sample[i * CHOIR_MODES + j], .resampler = data->resampler};
+					AddLoaderJob(loader, LoadSampleJob, &job, sizeof(job));
+				} else {
+					Progress(game);
+				}
+			} else {
+				struct SampleJob job = {
+					.sample = &data->sample[i * CHOIR_MODES + j],
+					.path = strdup(GetDataFilePath(game, PunchNumber(game, PunchNumber(game, "pX/Y.flac", 'X', i), 'Y', j + 1))),
+					.resampler = data->resampler,
+				};
+				AddLoaderJob(loader, LoadSampleJob, &job, sizeof(job));
+			}
+		}
+	}
 
 	data->buzia = CreateCharacter(game, "face");
 	RegisterSpritesheet(game, data->buzia, "1");
 	RegisterSpritesheet(game, data->buzia, "2");
-	LoadSpritesheets(game, data->buzia, progress);
-	progress(game);
+	{
+		TRACE_SCOPE_DETAIL("LoadSpritesheets", "face");
+		LoadSpritesheets(game, data->buzia, Progress);
+	}
+	Progress(game);
+
+	data->potato = calloc(choir->sprites, sizeof(struct Character*));
+	data->mask = calloc(choir->sprites, sizeof(struct HitMask*));
+	for (int i = 0; i < choir->sprites; i++) {
+		data->potato[i] = CreateCharacter(game, "potato");
+		RegisterSpritesheet(game, data->potato[i], PunchNumber(game, "X", 'X', i));
+		{
+			TRACE_SCOPE_DETAIL("LoadSpritesheets", PunchNumber(game, "potato X", 'X', i));
+			LoadSpritesheets(game, data->potato[i], Progress);
+		}
+		data->mask[i] = CreateHitMask(data->potato[i]->spritesheets->frames[0].bitmap);
+		UpdateLoader(loader);
+	}
 
-	for (int i = 0; i < 8; i++) {
+	data->pyry = calloc(choir->count, sizeof(struct Character*));
+	data->buzie = calloc(choir->count, sizeof(struct Character*));
+	data->mode = calloc(choir->count, sizeof(int));
+	data->frame = calloc(choir->count, sizeof(struct Frame));
+	data->mixer = calloc(choir->count, sizeof(ALLEGRO_MIXER*));
+	data->loop = calloc(choir->count * CHOIR_MODES, sizeof(struct Loop));
+	data->placement = calloc(choir->count, sizeof(ALLEGRO_TRANSFORM));
+	data->live = calloc(choir->count, sizeof(int));
+	data->sung = calloc(choir->count, sizeof(int));
+	data->request = calloc(choir->count, sizeof(struct Switch));
+
+	for (int i = 0; i < choir->count; i++) {
 		data->buzie[i] = CreateCharacter(game, "face");
 		data->buzie[i]->shared = true;
 		data->buzie[i]->spritesheets = data->buzia->spritesheets;
 		SelectSpritesheet(game, data->buzie[i], "1");
-		progress(game);
 
 		data->pyry[i] = CreateCharacter(game, "potato");
-		RegisterSpritesheet(game, data->pyry[i], PunchNumber(game, "X", 'X', i));
-		LoadSpritesheets(game, data->pyry[i], progress);
+		data->pyry[i]->shared = true;
+		data->pyry[i]->spritesheets = data->potato[choir->sprite[i]]->spritesheets;
+		SelectSpritesheet(game, data->pyry[i], PunchNumber(game, "X", 'X', choir->sprite[i]));
+
+		data->frame[i].transport = data->transport;
+		data->frame[i].monitor = data->monitor;
+		data->frame[i].bus = data->bus;
+		data->frame[i].send = choir->send[i];
+		data->frame[i].index = i;
+		if (data->engine) {
+			InitAnalysis(&data->frame[i].analysis, data->engine->frequency);
+			SetEnginePotato(data->engine, i, choir->pan[i], choir->send[i], AnalyzePotato, &data->frame[i]);
+		} else {
+			data->mixer[i] = al_create_mixer(al_get_voice_frequency(game->audio.v), ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
+			al_attach_mixer_to_mixer(data->mixer[i], data->transport->mixer);
+			InitAnalysis(&data->frame[i].analysis, al_get_mixer_frequency(data->mixer[i]));
+			al_set_mixer_postprocess_callback(data->mixer[i], MixerPostprocess, &data->frame[i]);
+		}
+		InitDeck(data->scheduler, i * 2, data->mixer[i]);
+		InitDeck(data->scheduler, i * 2 + 1, data->mixer[i]);
+		Progress(game);
+		UpdateLoader(loader);
+	}
 
-		data->mixer[i] = al_create_mixer(al_get_voice_frequency(game->audio.v), ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
-		al_attach_mixer_to_mixer(data->mixer[i], game->audio.music);
-		al_set_mixer_postprocess_callback(data->mixer[i], MixerPostprocess, &data->frame[i]);
-		progress(game);
+	// Potatoes never leave their places, so the grid is built once from their resting bounds
+	// padded by how far singing can stretch them.
+	float* bounds = malloc(sizeof(float) * choir->count * 4);
+	for (int i = 0; i < choir->count; i++) {
+		ALLEGRO_BITMAP* bitmap = data->potato[choir->sprite[i]]->spritesheets->frames[0].bitmap;
+		float w = al_get_bitmap_width(bitmap) * choir->scale[i], h = al_get_bitmap_height(bitmap) * choir->scale[i];
+		float margin = fmax(w, h) * HOVER_MARGIN;
+		bounds[i] = choir->x[i] - w / 2.0 - margin;
+		bounds[choir->count + i] = choir->y[i] - h / 2.0 - margin;
+		bounds[choir->count * 2 + i] = choir->x[i] + w / 2.0 + margin;
+		bounds[choir->count * 3 + i] = choir->y[i] + h / 2.0 + margin;
+	}
+	data->grid = CreateHitGrid(game->viewport.width, game->viewport.height, choir->count, bounds, bounds + choir->count, bounds + choir->count * 2, bounds + choir->count * 3);
+	free(bounds);
+
+	FinishLoader(loader);
 
-		for (int j = 0; j < 5; j++) {
-			data->sample[i][j] = al_load_sample(GetDataFilePath(game, PunchNumber(game, PunchNumber(game, "pX/Y.flac", 'X', i), 'Y', j + 1)));
-			data->song[i][j] = al_create_sample_instance(data->sample[i][j]);
-			al_attach_sample_instance_to_mixer(data->song[i][j], data->mixer[i]);
-			al_set_sample_instance_playmode(data->song[i][j], ALLEGRO_PLAYMODE_LOOP);
-			al_set_sample_instance_pan(data->song[i][j], -0.375 + (i % 4) * 0.25);
+	if (data->compressed) {
+		size_t size = 0;
+		for (int i = 0; i < choir->voices * CHOIR_MODES; i++) {
+			size += data->compressed[i] ? data->compressed[i]->size : 0;
+		}
+		PrintConsole(game, "compressed loops: %.1f MiB", size / 1048576.0);
+	}
 
-			if (al_get_sample_instance_length(data->song[i][j]) < 392020) {
-				PrintConsole(game, "TOO SHORT i %d j %d length %d", i, j + 1, al_get_sample_instance_length(data->song[i][j]));
-				//al_rest(1.0);
+	if (data->engine) {
+		data->pcm = calloc(choir->voices * CHOIR_MODES, sizeof(float*));
+		for (int i = 0; i < choir->voices * CHOIR_MODES; i++) {
+			if (data->sample[i]) {
+				ConvertEngineSample(data, i);
 			}
-			al_set_sample_instance_length(data->song[i][j], 391000);
+		}
+		PrintConsole(game, "Mixing the choir with the engine on %d worker threads", data->engine->submix ? data->engine->submix->count : 0);
+	}
 
-			progress(game);
+	// With the samples decoded, every potato gets its own instances of its voice.
+	for (int i = 0; i < choir->count; i++) {
+		for (int j = 0; j < CHOIR_MODES; j++) {
+			const char* path = GetDataFilePath(game, PunchNumber(game, PunchNumber(game, "pX/Y.flac", 'X', choir->voice[i]), 'Y', j + 1));
+			int index = choir->voice[i] * CHOIR_MODES + j;
+			LoadLoop(game, GetLoop(data, i, j), path, data->sample[index], data->compressed ? data->compressed[index] : NULL, data->mixer[i], choir->pan[i], data->length, streaming);
 		}
 	}
 
-	data->font = al_load_font(GetDataFilePath(game, "fonts/ComicNeue-Bold.ttf"), 96, 0);
-	progress(game);
+	data->font = TRACE_LOAD(al_load_font, GetDataFilePath(game, "fonts/ComicNeue-Bold.ttf"), 96, 0);
+	Progress(game);
+
+	while (loading.reported < Gamestate_ProgressCount) {
+		loading.reported++;
+		progress(game);
+	}
 
 	return data;
 }
@@ -392,16 +904,79 @@ void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
 	// Called when the gamestate library is being unloaded.
 	// Good place for freeing all allocated memory and resources.
 
-	for (int i = 0; i < 8; i++) {
+	if (data->prefetch) {
+		FinishLoader(data->prefetch); // lets the queued samples finish, so they get destroyed below
+	}
+	if (data->engine) {
+		DestroyEngine(data->engine); // before anything it reads from the audio thread goes away
+		for (int i = 0; i < data->choir->voices * CHOIR_MODES; i++) {
+			free(data->pcm[i]);
+		}
+		free(data->pcm);
+	}
+	for (int i = 0; i < data->choir->count; i++) {
 		DestroyCharacter(game, data->pyry[i]);
 		DestroyCharacter(game, data->buzie[i]);
-		for (int j = 0; j < 5; j++) {
-			al_destroy_sample_instance(data->song[i][j]);
-			al_destroy_sample(data->sample[i][j]);
+		for (int j = 0; j < CHOIR_MODES; j++) {
+			UnloadLoop(GetLoop(data, i, j));
+		}
+		if (data->mixer[i]) {
+			al_destroy_mixer(data->mixer[i]);
+		}
+	}
+	for (int i = 0; i < data->choir->voices * CHOIR_MODES; i++) {
+		if (data->sample[i]) {
+			al_destroy_sample(data->sample[i]);
+		}
+		if (data->compressed && data->compressed[i]) {
+			DestroyCompressedSample(data->compressed[i]);
+		}
+	}
+	for (int i = 0; i < data->choir->sprites; i++) {
+		DestroyCharacter(game, data->potato[i]);
+		if (data->mask[i]) {
+			DestroyHitMask(data->mask[i]);
 		}
-		al_destroy_mixer(data->mixer[i]);
 	}
+	DestroyHitGrid(data->grid);
+	free(data->pyry);
+	free(data->buzie);
+	free(data->mode);
+	free(data->frame);
+	free(data->mixer);
+	free(data->loop);
+	free(data->sample);
+	free(data->compressed);
+	free(data->state);
+	free(data->potato);
+	free(data->mask);
+	free(data->placement);
+	free(data->live);
+	free(data->sung);
+	free(data->request);
+	DestroyScheduler(data->scheduler);
+	if (data->resampler) {
+		DestroyResampler(data->resampler);
+	}
+	DestroyTransport(game, data->transport);
+	if (data->bus) {
+		DestroySendBus(data->bus);
+	}
+	DestroyDeadlineMonitor(data->monitor);
+	if (data->bank) {
+		DestroySoundBank(data->bank);
+	}
+	DestroySpriteBatch(data->batch);
+	DestroyAtlas(data->atlas);
+	DestroyLayer(data->layer);
+	for (int i = 0; i < data->choir->count; i++) {
+		if (!i || data->mics[i] != data->mics[i - 1]) {
+			al_destroy_bitmap(data->mics[i]);
+		}
+	}
+	free(data->mics);
 	DestroyCharacter(game, data->buzia);
+	DestroyChoir(data->choir);
 	al_destroy_bitmap(data->scene);
 	al_destroy_bitmap(data->light);
 	al_destroy_bitmap(data->mic);
@@ -412,30 +987,52 @@ void Gamestate_Unload(struct Game* game, struct GamestateResources* data) {
 void Gamestate_Start(struct Game* game, struct GamestateResources* data) {
 	// Called when this gamestate gets control. Good place for initializing state,
 	// playing music etc.
-	for (int i = 0; i < 4; i++) {
-		SetCharacterPosition(game, data->pyry[i], 300 * i + 600, pow(sin(i / 7.0 * ALLEGRO_PI), 2) * 20 + 470, 0);
-		data->pyry[i]->scaleX = 0.5;
-		data->pyry[i]->scaleY = 0.5;
-	}
-	for (int i = 4; i < 8; i++) {
-		SetCharacterPosition(game, data->pyry[i], 320 * (i - 4) + 500, pow(cos(i / 7.0 * ALLEGRO_PI), 2) * 50 + 630, 0);
-		data->pyry[i]->scaleX = 0.666;
-		data->pyry[i]->scaleY = 0.666;
+	struct Choir* choir = data->choir;
+	for (int i = 0; i < choir->count; i++) {
+		SetCharacterPosition(game, data->pyry[i], choir->x[i], choir->y[i], 0);
+		data->pyry[i]->scaleX = choir->scale[i];
+		data->pyry[i]->scaleY = choir->scale[i];
+		UpdatePlacement(game, data, i, NULL);
 	}
 
-	for (int i = 0; i < 8; i++) {
+	ResetTransport(data->transport);
+	// Every deck goes silent at once, and Logic detaches the loops once the audio thread got there.
+	ResetScheduler(data->scheduler);
+	for (int i = 0; i < choir->count; i++) {
+		data->live[i] = -1;
 		data->mode[i] = -1;
-		for (int j = 0; j < 5; j++) {
-			al_set_sample_instance_gain(data->song[i][j], 0.0);
-			al_play_sample_instance(data->song[i][j]);
+		data->sung[i] = -1;
+		RequestSample(data, i, 0);
+		if (data->stress) {
+			SetPotatoMode(data, i, i % CHOIR_MODES, QUANTUM_NONE, al_get_time());
 		}
 	}
+	data->arranged = 0;
+	if (game->data->benchmark) {
+		struct DeadlineStats stats;
+		ReadDeadlineStats(data->monitor, &stats, NULL);
+		SetBenchmarkAudio(game->data->benchmark, stats.cost_total, stats.blocks * stats.period);
+		StartBenchmarkChoir(game->data->benchmark, choir->count);
+	}
 	data->timer = 0;
 	data->hovered = -1;
+	data->hover = false;
 }
 
 void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
 	// Called when gamestate gets stopped. Stop timers, music etc. here.
+	PrintDeadlineStats(game, data->monitor);
+	PrintSchedulerStats(game, data->scheduler);
+	if (data->engine && data->engine->submix) {
+		PrintSubmixStats(game, data->engine->submix);
+	}
+	for (int i = 0; i < data->choir->count; i++) {
+		struct Analysis* analysis = &data->frame[i].analysis;
+		if (analysis->blocks) {
+			PrintConsole(game, "potato %d analysis: %u blocks, avg %.1f us, max %.1f us", i, analysis->blocks,
+				analysis->cost_total / analysis->blocks * 1000000.0, analysis->cost_max * 1000000.0);
+		}
+	}
 }
 
 // Optional endpoints:
@@ -443,6 +1040,33 @@ void Gamestate_Stop(struct Game* game, struct GamestateResources* data) {
 void Gamestate_PostLoad(struct Game* game, struct GamestateResources* data) {
 	// This is called in the main thread after Gamestate_Load has ended.
 	// Use it to prerender bitmaps, create VBOs, etc.
+	TRACE_SCOPE("game PostLoad");
+	data->atlas = CreateAtlas();
+	for (int i = 0; i <= data->choir->sprites; i++) {
+		struct Character* character = i < data->choir->sprites ? data->potato[i] : data->buzia;
+		for (struct Spritesheet* sheet = character->spritesheets; sheet; sheet = sheet->next) {
+			for (int j = 0; j < sheet->frame_count; j++) {
+				AddAtlasBitmap(data->atlas, sheet->frames[j].bitmap);
+			}
+		}
+	}
+
+	// Mics are drawn at a fifth of their size or so, so they get shrunk up front. Stress mode scales
+	// them all the same way, so potatoes next to each other share theirs.
+	data->mics = calloc(data->choir->count, sizeof(ALLEGRO_BITMAP*));
+	for (int i = 0; i < data->choir->count; i++) {
+		if (i && data->choir->mic_scale[i] == data->choir->mic_scale[i - 1]) {
+			data->mics[i] = data->mics[i - 1];
+		} else {
+			data->mics[i] = CreateScaledBitmap(data->mic, data->choir->mic_scale[i]);
+		}
+		AddAtlasBitmap(data->atlas, data->mics[i]);
+	}
+	AddAtlasBitmap(data->atlas, data->light);
+	BuildAtlas(data->atlas);
+	data->batch = CreateSpriteBatch();
+	data->layer = CreateLayer(DrawStaticLayer, data);
+	PrintConsole(game, "atlas: %d pages", GetAtlasPageCount(data->atlas));
 }
 
 void Gamestate_Pause(struct Game* game, struct GamestateResources* data) {
@@ -457,4 +1081,5 @@ void Gamestate_Resume(struct Game* game, struct GamestateResources* data) {
 void Gamestate_Reload(struct Game* game, struct GamestateResources* data) {
 	// Called when the display gets lost and not preserved bitmaps need to be recreated.
 	// Unless you want to support mobile platforms, you should be able to ignore it.
+	InvalidateLayer(data->layer);
 }
@@ -20,6 +20,7 @@
  */
 
 #include "../common.h"
+#include "../trace.h"
 #include <libsuperderpy.h>
 
 #define NEXT_GAMESTATE "dosowisko"
@@ -34,6 +35,7 @@ struct GamestateResources {
 int Gamestate_ProgressCount = 1;
 
 void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double delta) {
+	TRACE_SCOPE("holypangolin Logic");
 	data->counter += delta * 60;
 	if (data->counter > 60 * 5.2) {
 		SwitchCurrentGamestate(game, NEXT_GAMESTATE);
@@ -41,6 +43,7 @@ void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double
 }
 
 void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
+	TRACE_SCOPE("holypangolin Draw");
 	al_draw_scaled_bitmap(data->bmp, 0, 0, al_get_bitmap_width(data->bmp), al_get_bitmap_height(data->bmp), 0, 0, game->viewport.width, game->viewport.height, 0);
 
 	if (data->counter < 320) {
@@ -49,6 +52,7 @@ void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
 }
 
 void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data, ALLEGRO_EVENT* ev) {
+	TRACE_SCOPE("holypangolin ProcessEvent");
 	if (((ev->type == ALLEGRO_EVENT_KEY_DOWN) && (ev->keyboard.keycode == ALLEGRO_KEY_ESCAPE)) || (ev->type == ALLEGRO_EVENT_TOUCH_END) || (ev->type == ALLEGRO_EVENT_JOYSTICK_BUTTON_UP)) {
 		UnloadAllGamestates(game);
 		StartGamestate(game, SKIP_GAMESTATE);
@@ -56,11 +60,13 @@ void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data,
 }
 
 void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
+	TRACE_LOAD_SCOPE("holypangolin Load");
+	progress = TraceProgress("holypangolin", progress);
 	struct GamestateResources* data = malloc(sizeof(struct GamestateResources));
-	data->bmp = al_load_bitmap(GetDataFilePath(game, "holypangolin.webp"));
+	data->bmp = TRACE_LOAD(al_load_bitmap, GetDataFilePath(game, "holypangolin.webp"));
 	progress(game); // report that we progressed with the loading, so the engine can draw a progress bar
 
-	data->monkeys = al_load_audio_stream(GetDataFilePath(game, "holypangolin.flac"), 4, 2048);
+	data->monkeys = TRACE_LOAD(al_load_audio_stream, GetDataFilePath(game, "holypangolin.flac"), 4, 2048);
 	al_set_audio_stream_playing(data->monkeys, false);
 	al_attach_audio_stream_to_mixer(data->monkeys, game->audio.fx);
 	al_set_audio_stream_gain(data->monkeys, 0.75);
@@ -19,6 +19,7 @@
  */
 
 #include "../common.h"
+#include "../trace.h"
 #include <libsuperderpy.h>
 
 /*! \brief Resources used by Loading state. */
@@ -28,19 +29,25 @@ struct GamestateResources {
 
 int Gamestate_ProgressCount = -1;
 
-void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data, ALLEGRO_EVENT* ev){};
+void Gamestate_ProcessEvent(struct Game* game, struct GamestateResources* data, ALLEGRO_EVENT* ev) {
+	TRACE_SCOPE("loading ProcessEvent");
+};
 
-void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double delta){};
+void Gamestate_Logic(struct Game* game, struct GamestateResources* data, double delta) {
+	TRACE_SCOPE("loading Logic");
+};
 
 void Gamestate_Draw(struct Game* game, struct GamestateResources* data) {
+	TRACE_SCOPE("loading Draw");
 	al_draw_bitmap(data->stage, 0, 0, 0);
 	al_draw_filled_rectangle(game->viewport.width * 0.42, game->viewport.height * 0.55, game->viewport.width * 0.62, game->viewport.height * 0.57, al_map_rgba(222, 222, 222, 255));
 	al_draw_filled_rectangle(game->viewport.width * 0.42, game->viewport.height * 0.55, game->viewport.width * (0.42 + 0.2 * game->loading.progress), game->viewport.height * 0.57, al_map_rgba(128, 128, 128, 255));
 };
 
 void* Gamestate_Load(struct Game* game, void (*progress)(struct Game*)) {
+	TRACE_LOAD_SCOPE("loading Load");
 	struct GamestateResources* data = malloc(sizeof(struct GamestateResources));
-	data->stage = al_load_bitmap(GetDataFilePath(game, "scene.png"));
+	data->stage = TRACE_LOAD(al_load_bitmap, GetDataFilePath(game, "scene.png"));
 	return data;
 }
 
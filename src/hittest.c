@@ -0,0 +1,120 @@
+/*! \file hittest.c
+ *  \brief Precomputed collision masks and a spatial index for pointer hit testing.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "hittest.h"
+#include <libsuperderpy.h>
+
+struct HitMask* CreateHitMask(ALLEGRO_BITMAP* bitmap) {
+	ALLEGRO_LOCKED_REGION* region = al_lock_bitmap(bitmap, ALLEGRO_PIXEL_FORMAT_ABGR_8888, ALLEGRO_LOCK_READONLY);
+	if (!region) {
+		return NULL;
+	}
+
+	struct HitMask* mask = calloc(1, sizeof(struct HitMask));
+	mask->width = al_get_bitmap_width(bitmap);
+	mask->height = al_get_bitmap_height(bitmap);
+	mask->stride = (mask->width + 31) / 32;
+	mask->bits = calloc(mask->stride * mask->height, sizeof(uint32_t));
+
+	for (int y = 0; y < mask->height; y++) {
+		const uint32_t* row = (const uint32_t*)((const char*)region->data + y * region->pitch);
+		uint32_t* bits = mask->bits + y * mask->stride;
+		for (int x = 0; x < mask->width; x++) {
+			if (row[x] >> 24) {
+				bits[x / 32] |= 1u << (x % 32);
+			}
+		}
+	}
+
+	al_unlock_bitmap(bitmap);
+	return mask;
+}
+
+bool TestHitMask(struct HitMask* mask, float x, float y) {
+	if (x < 0 || y < 0 || x >= mask->width || y >= mask->height) {
+		return false;
+	}
+	int px = x, py = y;
+	return mask->bits[py * mask->stride + px / 32] & (1u << (px % 32));
+}
+
+void DestroyHitMask(struct HitMask* mask) {
+	free(mask->bits);
+	free(mask);
+}
+
+static void GetCellRange(struct HitGrid* grid, float left, float top, float right, float bottom, int* x1, int* y1, int* x2, int* y2) {
+	*x1 = Clamp(0, grid->cols - 1, floor(left / HITGRID_CELL));
+	*y1 = Clamp(0, grid->rows - 1, floor(top / HITGRID_CELL));
+	*x2 = Clamp(0, grid->cols - 1, floor(right / HITGRID_CELL));
+	*y2 = Clamp(0, grid->rows - 1, floor(bottom / HITGRID_CELL));
+}
+
+struct HitGrid* CreateHitGrid(int width, int height, int count, const float* left, const float* top, const float* right, const float* bottom) {
+	struct HitGrid* grid = calloc(1, sizeof(struct HitGrid));
+	grid->cols = (width + HITGRID_CELL - 1) / HITGRID_CELL;
+	grid->rows = (height + HITGRID_CELL - 1) / HITGRID_CELL;
+	int cells = grid->cols * grid->rows;
+	grid->start = calloc(cells + 1, sizeof(int));
+
+	// Count the items per cell, turn the counts into offsets, then fill the cells in item order.
+	int x1, y1, x2, y2;
+	for (int i = 0; i < count; i++) {
+		GetCellRange(grid, left[i], top[i], right[i], bottom[i], &x1, &y1, &x2, &y2);
+		for (int y = y1; y <= y2; y++) {
+			for (int x = x1; x <= x2; x++) {
+				grid->start[y * grid->cols + x + 1]++;
+			}
+		}
+	}
+	for (int i = 0; i < cells; i++) {
+		grid->start[i + 1] += grid->start[i];
+	}
+	grid->items = malloc(sizeof(int) * (grid->start[cells] ? grid->start[cells] : 1));
+
+	int* fill = malloc(sizeof(int) * cells);
+	memcpy(fill, grid->start, sizeof(int) * cells);
+	for (int i = 0; i < count; i++) {
+		GetCellRange(grid, left[i], top[i], right[i], bottom[i], &x1, &y1, &x2, &y2);
+		for (int y = y1; y <= y2; y++) {
+			for (int x = x1; x <= x2; x++) {
+				grid->items[fill[y * grid->cols + x]++] = i;
+			}
+		}
+	}
+	free(fill);
+	return grid;
+}
+
+int GetHitGridItems(struct HitGrid* grid, float x, float y, const int** items) {
+	if (x < 0 || y < 0 || x >= grid->cols * HITGRID_CELL || y >= grid->rows * HITGRID_CELL) {
+		return 0;
+	}
+	int cell = (int)(y / HITGRID_CELL) * grid->cols + (int)(x / HITGRID_CELL);
+	*items = grid->items + grid->start[cell];
+	return grid->start[cell + 1] - grid->start[cell];
+}
+
+void DestroyHitGrid(struct HitGrid* grid) {
+	free(grid->start);
+	free(grid->items);
+	free(grid);
+}
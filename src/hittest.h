@@ -0,0 +1,55 @@
+/*! \file hittest.h
+ *  \brief Precomputed collision masks and a spatial index for pointer hit testing.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_HITTEST_H
+#define POTATOES_HITTEST_H
+
+#include <allegro5/allegro.h>
+#include <stdint.h>
+
+#define HITGRID_CELL 64 // size of a grid cell, in stage pixels
+
+/*! \brief One bit per pixel of a bitmap, set where it isn't fully transparent. */
+struct HitMask {
+	int width, height;
+	int stride; // words per row
+	uint32_t* bits;
+};
+
+/*! \brief Uniform grid over the stage, listing which bounding boxes overlap each cell.
+ *
+ * Items are stored per cell in ascending order, so walking a cell backwards visits
+ * whatever is drawn on top first.
+ */
+struct HitGrid {
+	int cols, rows;
+	int* start; // cols * rows + 1 offsets into items
+	int* items;
+};
+
+struct HitMask* CreateHitMask(ALLEGRO_BITMAP* bitmap);
+bool TestHitMask(struct HitMask* mask, float x, float y);
+void DestroyHitMask(struct HitMask* mask);
+
+struct HitGrid* CreateHitGrid(int width, int height, int count, const float* left, const float* top, const float* right, const float* bottom);
+int GetHitGridItems(struct HitGrid* grid, float x, float y, const int** items);
+void DestroyHitGrid(struct HitGrid* grid);
+
+#endif
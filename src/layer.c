@@ -0,0 +1,82 @@
+/*! \file layer.c
+ *  \brief Cached render of the static parts of the stage.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "layer.h"
+#include "trace.h"
+#include <libsuperderpy.h>
+
+struct Layer* CreateLayer(void (*draw)(struct Game* game, void* userdata), void* userdata) {
+	struct Layer* layer = calloc(1, sizeof(struct Layer));
+	layer->draw = draw;
+	layer->userdata = userdata;
+	layer->dirty = true;
+	return layer;
+}
+
+static void RenderLayer(struct Game* game, struct Layer* layer, ALLEGRO_BITMAP* target) {
+	TRACE_SCOPE("RenderLayer");
+	int width = al_get_bitmap_width(target), height = al_get_bitmap_height(target);
+	if (!layer->bitmap || al_get_bitmap_width(layer->bitmap) != width || al_get_bitmap_height(layer->bitmap) != height) {
+		if (layer->bitmap) {
+			al_destroy_bitmap(layer->bitmap);
+		}
+		// Lives wherever the target does, so the software renderer keeps it in memory too.
+		int flags = al_get_new_bitmap_flags();
+		al_set_new_bitmap_flags((flags & ~(ALLEGRO_MEMORY_BITMAP | ALLEGRO_MIPMAP)) | (al_get_bitmap_flags(target) & ALLEGRO_MEMORY_BITMAP) | ALLEGRO_NO_PRESERVE_TEXTURE);
+		layer->bitmap = al_create_bitmap(width, height);
+		al_set_new_bitmap_flags(flags);
+		PrintConsole(game, "Static layer cached at %dx%d", width, height);
+	}
+
+	al_set_target_bitmap(layer->bitmap);
+	al_use_transform(&layer->transform);
+	al_clear_to_color(al_map_rgba(0, 0, 0, 0));
+	layer->draw(game, layer->userdata);
+	al_set_target_bitmap(target);
+	layer->dirty = false;
+}
+
+void DrawLayer(struct Game* game, struct Layer* layer) {
+	ALLEGRO_BITMAP* target = al_get_target_bitmap();
+	ALLEGRO_TRANSFORM transform = *al_get_current_transform();
+	if (layer->dirty || !layer->bitmap || al_get_bitmap_width(layer->bitmap) != al_get_bitmap_width(target) ||
+		al_get_bitmap_height(layer->bitmap) != al_get_bitmap_height(target) || memcmp(&layer->transform, &transform, sizeof(ALLEGRO_TRANSFORM)) != 0) {
+		layer->transform = transform;
+		RenderLayer(game, layer, target);
+	}
+
+	ALLEGRO_TRANSFORM identity;
+	al_identity_transform(&identity);
+	al_use_transform(&identity);
+	al_draw_bitmap(layer->bitmap, 0, 0, 0);
+	al_use_transform(&transform);
+}
+
+void InvalidateLayer(struct Layer* layer) {
+	layer->dirty = true;
+}
+
+void DestroyLayer(struct Layer* layer) {
+	if (layer->bitmap) {
+		al_destroy_bitmap(layer->bitmap);
+	}
+	free(layer);
+}
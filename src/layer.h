@@ -0,0 +1,48 @@
+/*! \file layer.h
+ *  \brief Cached render of the static parts of the stage.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_LAYER_H
+#define POTATOES_LAYER_H
+
+#include <allegro5/allegro.h>
+
+struct Game;
+
+/*! \brief Whatever a callback draws, cached in a bitmap as big as the target it's shown on.
+ *
+ * The cache gets rendered with the target's transform, so showing it is a 1:1 copy without any
+ * scaling or filtering, and it gets rebuilt whenever the target's size or transform changes (e.g.
+ * after a resize) or it's been invalidated. It's not preserved by Allegro, so it needs to be
+ * invalidated when the display gets lost.
+ */
+struct Layer {
+	ALLEGRO_BITMAP* bitmap; // NULL until first drawn
+	ALLEGRO_TRANSFORM transform; // the cache has been rendered with
+	bool dirty;
+	void (*draw)(struct Game* game, void* userdata);
+	void* userdata;
+};
+
+struct Layer* CreateLayer(void (*draw)(struct Game* game, void* userdata), void* userdata);
+void DrawLayer(struct Game* game, struct Layer* layer);
+void InvalidateLayer(struct Layer* layer);
+void DestroyLayer(struct Layer* layer);
+
+#endif
@@ -0,0 +1,192 @@
+/*! \file loader.c
+ *  \brief Worker pool for loading independent assets in parallel.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "loader.h"
+#include "trace.h"
+#include <libsuperderpy.h>
+
+struct LoaderJob {
+	void (*func)(struct Game*, void*);
+	struct LoaderJob* next;
+	max_align_t arg[];
+};
+
+struct Loader {
+	struct Game* game;
+	void (*progress)(struct Game*);
+
+	ALLEGRO_MUTEX* mutex;
+	ALLEGRO_COND* cond;
+	struct LoaderJob *head, *tail;
+	int pending; // jobs queued or running
+	int done; // jobs finished, but not reported with progress() yet
+	bool quit;
+
+	// New bitmap settings are thread-local, so workers need to inherit them from the loading thread.
+	int bitmap_flags, bitmap_format;
+
+	int count;
+	ALLEGRO_THREAD* threads[];
+};
+
+static void* LoaderThread(ALLEGRO_THREAD* thread, void* arg) {
+	struct Loader* loader = arg;
+	al_set_new_bitmap_flags(loader->bitmap_flags);
+	al_set_new_bitmap_format(loader->bitmap_format);
+	SetTraceThreadName("loader");
+
+	al_lock_mutex(loader->mutex);
+	while (true) {
+		while (!loader->head && !loader->quit) {
+			al_wait_cond(loader->cond, loader->mutex);
+		}
+		if (!loader->head) {
+			break;
+		}
+		struct LoaderJob* job = loader->head;
+		loader->head = job->next;
+		if (!loader->head) {
+			loader->tail = NULL;
+		}
+		al_unlock_mutex(loader->mutex);
+
+		job->func(loader->game, job->arg);
+		free(job);
+
+		al_lock_mutex(loader->mutex);
+		loader->pending--;
+		loader->done++;
+		al_broadcast_cond(loader->cond);
+	}
+	al_unlock_mutex(loader->mutex);
+	ReleaseTraceThread();
+	return NULL;
+}
+
+struct Loader* CreateLoader(struct Game* game, void (*progress)(struct Game*), int threads) {
+	// Without a thread count, there's one worker per CPU.
+	int count = threads > 0 ? threads : al_get_cpu_count();
+	if (count < 1) {
+		count = 1;
+	}
+	struct Loader* loader = calloc(1, sizeof(struct Loader) + sizeof(ALLEGRO_THREAD*) * count);
+	loader->game = game;
+	loader->progress = progress;
+	loader->mutex = al_create_mutex();
+	loader->cond = al_create_cond();
+	loader->bitmap_flags = al_get_new_bitmap_flags();
+	loader->bitmap_format = al_get_new_bitmap_format();
+
+	for (int i = 0; i < count; i++) {
+		ALLEGRO_THREAD* thread = al_create_thread(LoaderThread, loader);
+		if (!thread) {
+			break;
+		}
+		loader->threads[loader->count++] = thread;
+		al_start_thread(thread);
+	}
+	PrintConsole(game, "Loading with %d worker threads", loader->count);
+	return loader;
+}
+
+void AddLoaderJob(struct Loader* loader, void (*func)(struct Game*, void*), void* arg, size_t size) {
+	if (!loader->count) {
+		// no threads available, load in place
+		func(loader->game, arg);
+		if (loader->progress) {
+			loader->progress(loader->game);
+		}
+		return;
+	}
+
+	struct LoaderJob* job = malloc(sizeof(struct LoaderJob) + size);
+	job->func = func;
+	job->next = NULL;
+	memcpy(job->arg, arg, size);
+
+	al_lock_mutex(loader->mutex);
+	if (loader->tail) {
+		loader->tail->next = job;
+	} else {
+		loader->head = job;
+	}
+	loader->tail = job;
+	loader->pending++;
+	al_signal_cond(loader->cond);
+	al_unlock_mutex(loader->mutex);
+}
+
+struct BitmapJob {
+	ALLEGRO_BITMAP** bitmap;
+	char* path;
+};
+
+static void LoadBitmapJob(struct Game* game, void* arg) {
+	struct BitmapJob* job = arg;
+	TRACE_SCOPE_DETAIL("al_load_bitmap", job->path);
+	*job->bitmap = al_load_bitmap(job->path);
+	free(job->path);
+}
+
+void LoadBitmapAsync(struct Loader* loader, ALLEGRO_BITMAP** bitmap, const char* path) {
+	struct BitmapJob job = {.bitmap = bitmap, .path = strdup(path)};
+	AddLoaderJob(loader, LoadBitmapJob, &job, sizeof(job));
+}
+
+static void ReportProgress(struct Loader* loader, bool wait) {
+	// progress() is only ever called from the loading thread, as it would be with serial loading.
+	al_lock_mutex(loader->mutex);
+	while (loader->done || (wait && loader->pending)) {
+		if (!loader->done) {
+			al_wait_cond(loader->cond, loader->mutex);
+			continue;
+		}
+		loader->done--;
+		if (!loader->progress) {
+			continue;
+		}
+		al_unlock_mutex(loader->mutex);
+		loader->progress(loader->game);
+		al_lock_mutex(loader->mutex);
+	}
+	al_unlock_mutex(loader->mutex);
+}
+
+void UpdateLoader(struct Loader* loader) {
+	ReportProgress(loader, false);
+}
+
+void FinishLoader(struct Loader* loader) {
+	ReportProgress(loader, true);
+
+	al_lock_mutex(loader->mutex);
+	loader->quit = true;
+	al_broadcast_cond(loader->cond);
+	al_unlock_mutex(loader->mutex);
+
+	for (int i = 0; i < loader->count; i++) {
+		al_join_thread(loader->threads[i], NULL);
+		al_destroy_thread(loader->threads[i]);
+	}
+	al_destroy_cond(loader->cond);
+	al_destroy_mutex(loader->mutex);
+	free(loader);
+}
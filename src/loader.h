@@ -0,0 +1,36 @@
+/*! \file loader.h
+ *  \brief Worker pool for loading independent assets in parallel.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_LOADER_H
+#define POTATOES_LOADER_H
+
+#include <allegro5/allegro.h>
+#include <stddef.h>
+
+struct Game;
+struct Loader;
+
+struct Loader* CreateLoader(struct Game* game, void (*progress)(struct Game*), int threads);
+void AddLoaderJob(struct Loader* loader, void (*func)(struct Game*, void*), void* arg, size_t size);
+void LoadBitmapAsync(struct Loader* loader, ALLEGRO_BITMAP** bitmap, const char* path);
+void UpdateLoader(struct Loader* loader);
+void FinishLoader(struct Loader* loader);
+
+#endif
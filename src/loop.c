@@ -0,0 +1,140 @@
+/*! \file loop.c
+ *  \brief Choir loops, either preloaded or streamed from disk.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "loop.h"
+#include "compressed.h"
+#include "trace.h"
+#include "transport.h"
+#include <libsuperderpy.h>
+
+#define STREAM_FRAGMENTS 4
+#define STREAM_SAMPLES 2048
+
+ALLEGRO_SAMPLE* LoadLoopSample(struct Game* game, const char* path, unsigned int length) {
+	ALLEGRO_SAMPLE* sample = TRACE_LOAD(al_load_sample, path);
+	if (sample && al_get_sample_length(sample) < length + LOOP_MARGIN) {
+		PrintConsole(game, "TOO SHORT %s length %d", path, al_get_sample_length(sample));
+		//al_rest(1.0);
+	}
+	return sample;
+}
+
+void LoadLoop(struct Game* game, struct Loop* loop, const char* path, ALLEGRO_SAMPLE* sample, struct CompressedSample* compressed, ALLEGRO_MIXER* mixer, float pan, unsigned int length, bool streaming) {
+	loop->path = strdup(path);
+	loop->mixer = mixer;
+	loop->pan = pan;
+	loop->streaming = streaming;
+	loop->active = false;
+	loop->stream = NULL;
+	loop->compressed = compressed;
+
+	if (streaming) {
+		loop->sample = NULL;
+		loop->instance = NULL;
+		return;
+	}
+
+	// The sample is owned by the caller, so potatoes singing the same voice can share it.
+	loop->sample = NULL;
+	loop->instance = NULL;
+	if (sample) {
+		SetLoopSample(NULL, loop, sample, length);
+	}
+}
+
+static void AttachInstance(struct Transport* transport, struct Loop* loop) {
+	al_set_sample_instance_gain(loop->instance, 0.0);
+	al_set_sample_instance_playing(loop->instance, true);
+	al_attach_sample_instance_to_mixer(loop->instance, loop->mixer);
+	SyncSampleInstance(transport, loop->instance);
+	al_set_sample_instance_gain(loop->instance, 1.0);
+}
+
+void SetLoopSample(struct Transport* transport, struct Loop* loop, ALLEGRO_SAMPLE* sample, unsigned int length) {
+	loop->sample = sample;
+	loop->instance = al_create_sample_instance(loop->sample);
+	al_set_sample_instance_playmode(loop->instance, ALLEGRO_PLAYMODE_LOOP);
+	al_set_sample_instance_pan(loop->instance, loop->pan);
+	al_set_sample_instance_length(loop->instance, length);
+
+	// Activated while still waiting for its sample: it comes in late, but at the position it should be at.
+	if (loop->active) {
+		AttachInstance(transport, loop);
+	}
+}
+
+void UnloadLoop(struct Loop* loop) {
+	if (loop->stream) {
+		al_destroy_audio_stream(loop->stream);
+	}
+	if (loop->instance) {
+		al_destroy_sample_instance(loop->instance);
+	}
+	free(loop->path);
+}
+
+static void SetStreamActive(struct Transport* transport, struct Loop* loop, bool active) {
+	if (!active) {
+		al_destroy_audio_stream(loop->stream);
+		loop->stream = NULL;
+		return;
+	}
+
+	if (loop->compressed) {
+		loop->stream = CreateCompressedStream(loop->compressed, STREAM_FRAGMENTS, STREAM_SAMPLES);
+	} else {
+		loop->stream = al_load_audio_stream(loop->path, STREAM_FRAGMENTS, STREAM_SAMPLES);
+	}
+	if (!loop->stream) {
+		return;
+	}
+	al_set_audio_stream_playing(loop->stream, false);
+	al_set_audio_stream_playmode(loop->stream, ALLEGRO_PLAYMODE_LOOP);
+	al_set_audio_stream_loop_secs(loop->stream, 0.0, transport->length / (double)transport->frequency);
+	al_set_audio_stream_pan(loop->stream, loop->pan);
+	SyncAudioStream(transport, loop->stream);
+	al_set_audio_stream_playing(loop->stream, true);
+	al_attach_audio_stream_to_mixer(loop->stream, loop->mixer);
+}
+
+void SetLoopActive(struct Transport* transport, struct Loop* loop, bool active) {
+	if (loop->active == active) {
+		return;
+	}
+	loop->active = active;
+
+	if (loop->streaming) {
+		SetStreamActive(transport, loop, active);
+		return;
+	}
+
+	if (!loop->instance) {
+		return; // attached once the sample arrives
+	}
+
+	// Only audible loops are attached to a mixer; the others are "virtual" and cost nothing
+	// until they get reattached at the position they would have been playing at.
+	if (!active) {
+		al_detach_sample_instance(loop->instance);
+		return;
+	}
+	AttachInstance(transport, loop);
+}
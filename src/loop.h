@@ -0,0 +1,66 @@
+/*! \file loop.h
+ *  \brief Choir loops, either preloaded or streamed from disk.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_LOOP_H
+#define POTATOES_LOOP_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+
+#define LOOP_LENGTH 391000
+#define LOOP_FREQUENCY 44100
+#define LOOP_BEATS 8
+#define LOOP_BEATS_PER_BAR 4
+#define LOOP_MARGIN 1020 // loops shorter than LOOP_LENGTH + LOOP_MARGIN are considered broken
+
+struct Game;
+struct Transport;
+struct CompressedSample;
+
+/*! \brief A single choir loop.
+ *
+ * Preloaded loops play a decoded sample shared with other loops of the same voice and only
+ * attach their instance to the mixer while audible. Streamed loops decode nothing until they become audible;
+ * then an audio stream gets opened for them and fed from Allegro's fragment ring, either from the file
+ * or from its compressed copy in memory.
+ *
+ * A preloaded loop can also be created before its sample is there. It can be activated right away,
+ * but stays silent until SetLoopSample() hands it the sample, at which point it joins the transport.
+ */
+struct Loop {
+	char* path;
+	ALLEGRO_MIXER* mixer;
+	float pan;
+	bool streaming;
+	bool active;
+
+	ALLEGRO_SAMPLE* sample;
+	ALLEGRO_SAMPLE_INSTANCE* instance;
+	ALLEGRO_AUDIO_STREAM* stream;
+	struct CompressedSample* compressed; // owned by the caller; NULL to stream from the file
+};
+
+ALLEGRO_SAMPLE* LoadLoopSample(struct Game* game, const char* path, unsigned int length);
+void LoadLoop(struct Game* game, struct Loop* loop, const char* path, ALLEGRO_SAMPLE* sample, struct CompressedSample* compressed, ALLEGRO_MIXER* mixer, float pan, unsigned int length, bool streaming);
+void SetLoopSample(struct Transport* transport, struct Loop* loop, ALLEGRO_SAMPLE* sample, unsigned int length);
+void UnloadLoop(struct Loop* loop);
+void SetLoopActive(struct Transport* transport, struct Loop* loop, bool active);
+
+#endif
@@ -19,7 +19,9 @@
  */
 
 #include "common.h"
+#include "benchmark.h"
 #include "defines.h"
+#include "mixdown.h"
 #include <libsuperderpy.h>
 #include <signal.h>
 #include <stdio.h>
@@ -42,6 +44,23 @@ int main(int argc, char** argv) {
 	al_set_org_name("Holy Pangolin");
 	al_set_app_name(LIBSUPERDERPY_GAMENAME_PRETTY);
 
+	// Renders an arrangement to a file without opening a display or an audio device.
+	if (argc > 1 && strcmp(argv[1], "--mixdown") == 0) {
+		return Mixdown(argc, argv);
+	}
+
+	// Plays through a script of arrangements and reports frame times; see benchmark.h.
+	struct Benchmark* benchmark = NULL;
+	if (argc > 1 && strcmp(argv[1], "--benchmark") == 0) {
+		int frames = argc > 2 ? strtol(argv[2], NULL, 10) : 0;
+		benchmark = CreateBenchmark(frames > 0 ? frames : BENCHMARK_FRAMES);
+		argc = 1; // the rest of the arguments are ours
+	}
+
+	// al_get_time counts from al_init, which libsuperderpy_init would call anyway
+	al_init();
+	double startup = al_get_time();
+
 	struct Game* game = libsuperderpy_init(argc, argv, LIBSUPERDERPY_GAMENAME,
 		(struct Params){
 			1920,
@@ -49,6 +68,10 @@ int main(int argc, char** argv) {
 			.handlers = {
 				.event = GlobalEventHandler,
 				.destroy = DestroyGameData,
+				.prelogic = benchmark ? BenchmarkPreLogic : NULL,
+				.postlogic = benchmark ? BenchmarkPostLogic : NULL,
+				.predraw = benchmark ? BenchmarkPreDraw : NULL,
+				.postdraw = GlobalPostDraw,
 			},
 		});
 	if (!game) { return 1; }
@@ -59,7 +82,8 @@ int main(int argc, char** argv) {
 	LoadGamestate(game, "dosowisko");
 	StartGamestate(game, "holypangolin");
 
-	game->data = CreateGameData(game);
+	game->data = CreateGameData(game, startup);
+	game->data->benchmark = benchmark;
 
 	al_show_mouse_cursor(game->display);
 
@@ -0,0 +1,321 @@
+/*! \file mixdown.c
+ *  \brief Offline rendering of the choir mix.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "mixdown.h"
+#include "choir.h"
+#include "defines.h"
+#include "loop.h"
+#include "resample.h"
+#include "sendbus.h"
+#include "simd.h"
+#include <allegro5/allegro_acodec.h>
+#include <libsuperderpy.h>
+#include <time.h>
+
+float* ConvertMixdownData(ALLEGRO_SAMPLE* sample, unsigned int length) {
+	if (al_get_sample_channels(sample) != ALLEGRO_CHANNEL_CONF_1 || al_get_sample_length(sample) < length) {
+		return NULL;
+	}
+
+	float* data = malloc(sizeof(float) * (length + 1));
+	if (al_get_sample_depth(sample) == ALLEGRO_AUDIO_DEPTH_FLOAT32) {
+		memcpy(data, al_get_sample_data(sample), sizeof(float) * length);
+	} else {
+		const int16_t* src = al_get_sample_data(sample);
+		for (unsigned int i = 0; i < length; i++) {
+			data[i] = src[i] / 32768.0f;
+		}
+	}
+	data[length] = data[0]; // interpolation at the loop end wraps around to its start
+	return data;
+}
+
+float* LoadMixdownData(const char* path, unsigned int length) {
+	ALLEGRO_SAMPLE* sample = al_load_sample(path);
+	if (!sample) {
+		return NULL;
+	}
+	float* data = ConvertMixdownData(sample, length);
+	al_destroy_sample(sample);
+	return data;
+}
+
+void InitMixdownVoice(struct MixdownVoice* voice, const float* data, unsigned int length, unsigned int frequency, float pan) {
+	voice->data = data;
+	voice->length = length;
+	voice->frequency = frequency;
+	voice->position = 0;
+	voice->error = 0;
+	// same pan law as al_set_sample_instance_pan
+	voice->left = sqrt((1.0 - pan) / 2.0);
+	voice->right = sqrt((1.0 + pan) / 2.0);
+}
+
+void MixVoice(struct MixdownVoice* voice, float* buffer, unsigned int frames, unsigned int frequency) {
+	if (voice->frequency == frequency) {
+		// Without resampling, runs up to the loop end get mixed two stereo frames per vector.
+		const v4sf gains = {voice->left, voice->right, voice->left, voice->right};
+		unsigned int i = 0;
+		while (i < frames) {
+			unsigned int run = voice->length - voice->position;
+			if (run > frames - i) {
+				run = frames - i;
+			}
+			const float* src = voice->data + voice->position;
+			float* dst = buffer + i * 2;
+			unsigned int j = 0;
+			for (; j + 2 <= run; j += 2) {
+				v4sf v = {src[j], src[j], src[j + 1], src[j + 1]};
+				v4sf_store(dst + j * 2, v4sf_load(dst + j * 2) + v * gains);
+			}
+			for (; j < run; j++) {
+				dst[j * 2] += src[j] * voice->left;
+				dst[j * 2 + 1] += src[j] * voice->right;
+			}
+			i += run;
+			voice->position += run;
+			if (voice->position >= voice->length) {
+				voice->position -= voice->length;
+			}
+		}
+		return;
+	}
+
+	unsigned int step = voice->frequency / frequency, delta = voice->frequency % frequency;
+	for (unsigned int i = 0; i < frames; i++) {
+		const float* src = voice->data + voice->position;
+		float sample = src[0] + (src[1] - src[0]) * (voice->error / (float)frequency);
+		buffer[i * 2] += sample * voice->left;
+		buffer[i * 2 + 1] += sample * voice->right;
+
+		voice->position += step;
+		voice->error += delta;
+		if (voice->error >= frequency) {
+			voice->error -= frequency;
+			voice->position++;
+		}
+		while (voice->position >= voice->length) {
+			voice->position -= voice->length;
+		}
+	}
+}
+
+static void WriteLE(FILE* file, uint32_t value, int bytes) {
+	for (int i = 0; i < bytes; i++) {
+		fputc((value >> (i * 8)) & 0xFF, file);
+	}
+}
+
+void WriteWavHeader(FILE* file, unsigned int frequency, unsigned int channels, uint32_t frames) {
+	// 16-bit PCM, the same as what the voice gets fed with by default
+	uint32_t size = frames * channels * sizeof(int16_t);
+	fwrite("RIFF", 4, 1, file);
+	WriteLE(file, 36 + size, 4);
+	fwrite("WAVEfmt ", 8, 1, file);
+	WriteLE(file, 16, 4);
+	WriteLE(file, 1, 2); // PCM
+	WriteLE(file, channels, 2);
+	WriteLE(file, frequency, 4);
+	WriteLE(file, frequency * channels * sizeof(int16_t), 4);
+	WriteLE(file, channels * sizeof(int16_t), 2);
+	WriteLE(file, 16, 2);
+	fwrite("data", 4, 1, file);
+	WriteLE(file, size, 4);
+}
+
+static char* FindMixdownData(void) {
+	// Same places libsuperderpy looks at for an installed or an in-tree build.
+	const char* candidates[] = {"data", "../share/" LIBSUPERDERPY_GAMENAME "/data", "../data"};
+	ALLEGRO_PATH* resources = al_get_standard_path(ALLEGRO_RESOURCES_PATH);
+	for (size_t i = 0; i < sizeof(candidates) / sizeof(candidates[0]); i++) {
+		ALLEGRO_PATH* path = al_create_path_for_directory(candidates[i]);
+		al_rebase_path(resources, path);
+		al_set_path_filename(path, "choir.ini");
+		if (al_filename_exists(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP))) {
+			al_set_path_filename(path, NULL);
+			char* result = strdup(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+			al_destroy_path(path);
+			al_destroy_path(resources);
+			return result;
+		}
+		al_destroy_path(path);
+	}
+	al_destroy_path(resources);
+	return NULL;
+}
+
+static char* GetMixdownScene(void) {
+	// The game isn't running, so its config is read directly from where libsuperderpy keeps it.
+	ALLEGRO_PATH* path = al_get_standard_path(ALLEGRO_USER_SETTINGS_PATH);
+	al_set_path_filename(path, "SuperDerpy.ini");
+	ALLEGRO_CONFIG* config = al_load_config_file(al_path_cstr(path, ALLEGRO_NATIVE_PATH_SEP));
+	al_destroy_path(path);
+	const char* scene = config ? al_get_config_value(config, "potatoes", "scene") : NULL;
+	char* result = strdup(scene ? scene : "choir.ini");
+	if (config) {
+		al_destroy_config(config);
+	}
+	return result;
+}
+
+static void PrintMixdownUsage(const char* name) {
+	fprintf(stderr, "usage: %s --mixdown <output.wav> <arrangement> <seconds> [frequency]\n", name);
+	fprintf(stderr, "The arrangement lists the loop sung by each potato (1-5, 0 for silence), e.g. 1,0,3,0,0,5,2,0\n");
+}
+
+int Mixdown(int argc, char** argv) {
+	if (argc < 5) {
+		PrintMixdownUsage(argv[0]);
+		return 1;
+	}
+	const char* output = argv[2];
+	double seconds = strtod(argv[4], NULL);
+	unsigned int frequency = argc > 5 ? strtol(argv[5], NULL, 10) : LOOP_FREQUENCY;
+	if (seconds <= 0 || !frequency) {
+		PrintMixdownUsage(argv[0]);
+		return 1;
+	}
+
+	// No display and no audio device, just the codecs.
+	if (!al_init() || !al_init_acodec_addon()) {
+		fprintf(stderr, "failed to initialize Allegro\n");
+		return 1;
+	}
+
+	char* dir = FindMixdownData();
+	if (!dir) {
+		fprintf(stderr, "could not find the data directory\n");
+		return 1;
+	}
+	char path[4096];
+	char* scene = GetMixdownScene();
+	snprintf(path, sizeof(path), "%s%s", dir, scene);
+	free(scene);
+	struct Choir* choir = LoadChoir(NULL, path, 0);
+	if (!choir) {
+		fprintf(stderr, "could not load the choir from %s\n", path);
+		free(dir);
+		return 1;
+	}
+
+	int result = 1;
+	struct SendBus* bus = NULL;
+
+	// Loops get resampled up front like in the game, so the voices are mixed without any rate conversion.
+	struct Resampler* resampler = frequency != LOOP_FREQUENCY ? CreateResampler(LOOP_FREQUENCY, frequency) : NULL;
+	unsigned int length = resampler ? GetResampledLength(resampler, LOOP_LENGTH) : LOOP_LENGTH;
+
+	// Every loop that's sung gets decoded once, no matter how many potatoes sing it.
+	float** data = calloc(choir->voices * CHOIR_MODES, sizeof(float*));
+	struct MixdownVoice* voices = calloc(choir->count, sizeof(struct MixdownVoice));
+	float* sends = calloc(choir->count, sizeof(float));
+	int count = 0;
+	const char* arrangement = argv[3];
+	for (int i = 0; i < choir->count && *arrangement; i++) {
+		char* end;
+		int mode = strtol(arrangement, &end, 10);
+		arrangement = *end ? end + 1 : end;
+		if (mode < 1 || mode > CHOIR_MODES) {
+			continue;
+		}
+		float** loop = &data[choir->voice[i] * CHOIR_MODES + mode - 1];
+		if (!*loop) {
+			snprintf(path, sizeof(path), "%sp%d/%d.flac", dir, choir->voice[i], mode);
+			*loop = LoadMixdownData(path, LOOP_LENGTH);
+			if (!*loop) {
+				fprintf(stderr, "could not load %s\n", path);
+				continue;
+			}
+			if (resampler) {
+				float* resampled = ResampleLoop(resampler, *loop, LOOP_LENGTH);
+				free(*loop);
+				*loop = resampled;
+			}
+		}
+		sends[count] = choir->send[i];
+		InitMixdownVoice(&voices[count++], *loop, length, resampler ? frequency : LOOP_FREQUENCY, choir->pan[i]);
+	}
+
+	FILE* file = fopen(output, "wb");
+	if (!file) {
+		perror(output);
+		goto cleanup;
+	}
+	uint32_t frames = seconds * frequency;
+	WriteWavHeader(file, frequency, 2, frames);
+
+	// Same room reverb as in the game, so voices that send into it get mixed on their own first.
+	bus = CreateSendBus(frequency, 0);
+	float buffer[MIXDOWN_BLOCK * 2], voice[MIXDOWN_BLOCK * 2];
+	uint8_t pcm[MIXDOWN_BLOCK * 2 * sizeof(int16_t)];
+	clock_t start = clock();
+	for (uint32_t done = 0; done < frames;) {
+		unsigned int block = frames - done < MIXDOWN_BLOCK ? frames - done : MIXDOWN_BLOCK;
+		memset(buffer, 0, sizeof(float) * block * 2);
+		for (int i = 0; i < count; i++) {
+			if (sends[i] <= 0.0) {
+				MixVoice(&voices[i], buffer, block, frequency);
+				continue;
+			}
+			memset(voice, 0, sizeof(float) * block * 2);
+			MixVoice(&voices[i], voice, block, frequency);
+			for (unsigned int j = 0; j < block * 2; j++) {
+				buffer[j] += voice[j];
+			}
+			SendToBus(bus, voice, block, 0, sends[i]);
+		}
+		ProcessSendBus(bus, buffer, block);
+		for (unsigned int i = 0; i < block * 2; i++) {
+			uint16_t value = (int16_t)(Clamp(-1.0, 1.0, buffer[i]) * 32767);
+			pcm[i * 2] = value & 0xFF;
+			pcm[i * 2 + 1] = value >> 8;
+		}
+		fwrite(pcm, sizeof(int16_t), block * 2, file);
+		done += block;
+	}
+	double cpu = (clock() - start) / (double)CLOCKS_PER_SEC;
+	bool failed = ferror(file);
+	if (fclose(file) != 0 || failed) {
+		perror(output);
+		goto cleanup;
+	}
+	result = 0;
+
+	printf("%d voices, %.1f s of audio rendered in %.3f CPU s (%.1f s of audio per CPU second)\n",
+		count, frames / (double)frequency, cpu, cpu > 0 ? frames / (double)frequency / cpu : 0.0);
+
+cleanup:
+	for (int i = 0; i < choir->voices * CHOIR_MODES; i++) {
+		free(data[i]);
+	}
+	free(data);
+	free(voices);
+	free(sends);
+	if (bus) {
+		DestroySendBus(bus);
+	}
+	if (resampler) {
+		DestroyResampler(resampler);
+	}
+	DestroyChoir(choir);
+	free(dir);
+	return result;
+}
@@ -0,0 +1,52 @@
+/*! \file mixdown.h
+ *  \brief Offline rendering of the choir mix.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_MIXDOWN_H
+#define POTATOES_MIXDOWN_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define MIXDOWN_BLOCK 1024 // frames rendered at once
+
+/*! \brief A looping mono voice mixed into a stereo buffer.
+ *
+ * Mirrors what Allegro does for a looping sample instance attached to a stereo mixer:
+ * constant power panning, exact rational stepping and linear interpolation.
+ */
+struct MixdownVoice {
+	const float* data; // length + 1 frames, the last one repeating the first
+	unsigned int length;
+	unsigned int frequency; // of the data
+	unsigned int position; // in frames of the data
+	unsigned int error; // fractional part of the position, in output frames
+	float left, right;
+};
+
+float* ConvertMixdownData(ALLEGRO_SAMPLE* sample, unsigned int length);
+float* LoadMixdownData(const char* path, unsigned int length);
+void InitMixdownVoice(struct MixdownVoice* voice, const float* data, unsigned int length, unsigned int frequency, float pan);
+void MixVoice(struct MixdownVoice* voice, float* buffer, unsigned int frames, unsigned int frequency);
+void WriteWavHeader(FILE* file, unsigned int frequency, unsigned int channels, uint32_t frames);
+int Mixdown(int argc, char** argv);
+
+#endif
@@ -0,0 +1,117 @@
+/*! \file resample.c
+ *  \brief Polyphase resampling of the choir loops to the output rate.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "resample.h"
+#include "mixdown.h"
+#include "simd.h"
+#include <libsuperderpy.h>
+
+static double BesselI0(double x) {
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+struct Resampler* CreateResampler(unsigned int from, unsigned int to) {
+	struct Resampler* resampler = calloc(1, sizeof(struct Resampler));
+	resampler->from = from;
+	resampler->to = to;
+	resampler->phases = malloc(sizeof(float) * (RESAMPLE_PHASES + 1) * RESAMPLE_TAPS);
+
+	// When going down, the cutoff follows the output's Nyquist frequency, so nothing folds back.
+	double cutoff = (to < from ? (double)to / from : 1.0) * 0.95;
+	double half = RESAMPLE_TAPS / 2.0;
+	for (int p = 0; p <= RESAMPLE_PHASES; p++) {
+		// Tap k multiplies the input frame at k - RESAMPLE_TAPS / 2 + 1 from the output's position.
+		double frac = p / (double)RESAMPLE_PHASES;
+		for (int k = 0; k < RESAMPLE_TAPS; k++) {
+			double x = frac + half - 1 - k;
+			double sinc = x == 0.0 ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+			double w = x / half;
+			double window = fabs(w) >= 1.0 ? 0.0 : BesselI0(RESAMPLE_BETA * sqrt(1.0 - w * w)) / BesselI0(RESAMPLE_BETA);
+			resampler->phases[p * RESAMPLE_TAPS + k] = cutoff * sinc * window;
+		}
+	}
+	return resampler;
+}
+
+void DestroyResampler(struct Resampler* resampler) {
+	free(resampler->phases);
+	free(resampler);
+}
+
+unsigned int GetResampledLength(struct Resampler* resampler, unsigned int length) {
+	return ((uint64_t)length * resampler->to + resampler->from / 2) / resampler->from;
+}
+
+static inline float DotTaps(const float* x, const float* taps) {
+	v4sf sum = v4sf_set1(0.0);
+	for (int k = 0; k < RESAMPLE_TAPS; k += 4) {
+		sum += v4sf_load(x + k) * v4sf_load(taps + k);
+	}
+	return v4sf_sum(sum);
+}
+
+float* ResampleLoop(struct Resampler* resampler, const float* data, unsigned int length) {
+	unsigned int out = GetResampledLength(resampler, length);
+
+	// The loop gets padded with its own other end, so every output frame is a plain dot product.
+	int pad = RESAMPLE_TAPS;
+	float* padded = malloc(sizeof(float) * (length + pad * 2));
+	for (int i = 0; i < (int)length + pad * 2; i++) {
+		padded[i] = data[((i - pad) % (int)length + length) % length];
+	}
+
+	// Output frame j sits at j * length / out in the input, so the loop closes exactly.
+	float* result = malloc(sizeof(float) * (out + 1));
+	for (unsigned int j = 0; j < out; j++) {
+		uint64_t position = (uint64_t)j * length;
+		unsigned int base = position / out;
+		double phase = (position % out) * (double)RESAMPLE_PHASES / out;
+		int p = phase;
+		float t = phase - p;
+
+		const float* x = padded + pad + base - RESAMPLE_TAPS / 2 + 1;
+		float a = DotTaps(x, resampler->phases + p * RESAMPLE_TAPS);
+		float b = DotTaps(x, resampler->phases + (p + 1) * RESAMPLE_TAPS);
+		result[j] = a + (b - a) * t;
+	}
+	result[out] = result[0]; // same wrap guard as LoadMixdownData
+	free(padded);
+	return result;
+}
+
+ALLEGRO_SAMPLE* ResampleLoopSample(struct Resampler* resampler, ALLEGRO_SAMPLE* sample, unsigned int length) {
+	float* data = ConvertMixdownData(sample, length);
+	if (!data) {
+		return NULL;
+	}
+	float* result = ResampleLoop(resampler, data, length);
+	free(data);
+	ALLEGRO_SAMPLE* resampled = al_create_sample(result, GetResampledLength(resampler, length), resampler->to, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_1, true);
+	if (!resampled) {
+		free(result);
+	}
+	return resampled;
+}
@@ -0,0 +1,48 @@
+/*! \file resample.h
+ *  \brief Polyphase resampling of the choir loops to the output rate.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_RESAMPLE_H
+#define POTATOES_RESAMPLE_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+
+#define RESAMPLE_TAPS 32 // per phase; a multiple of 4
+#define RESAMPLE_PHASES 256 // filter phases per input sample; positions in between are interpolated
+#define RESAMPLE_BETA 9.0 // of the Kaiser window
+
+/*! \brief Windowed sinc filter bank for converting between two sample rates.
+ *
+ * Loops get resampled as a whole, wrapping around their ends, so the result loops seamlessly.
+ * Its length is rounded to whole frames, which makes the loop a tiny bit shorter or longer
+ * (well under a millisecond per hour), so the transport has to be told about it.
+ */
+struct Resampler {
+	unsigned int from, to;
+	float* phases; // RESAMPLE_PHASES + 1 phases of RESAMPLE_TAPS coefficients each
+};
+
+struct Resampler* CreateResampler(unsigned int from, unsigned int to);
+void DestroyResampler(struct Resampler* resampler);
+unsigned int GetResampledLength(struct Resampler* resampler, unsigned int length);
+float* ResampleLoop(struct Resampler* resampler, const float* data, unsigned int length);
+ALLEGRO_SAMPLE* ResampleLoopSample(struct Resampler* resampler, ALLEGRO_SAMPLE* sample, unsigned int length);
+
+#endif
@@ -0,0 +1,320 @@
+/*! \file scheduler.c
+ *  \brief Loop switches applied by the audio thread at exact frames.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "scheduler.h"
+#include "seqlock.h"
+#include "simd.h"
+#include "transport.h"
+#include <libsuperderpy.h>
+
+float GetDeckGain(struct Deck* deck, uint64_t frame) {
+	if (frame < deck->at) {
+		return deck->from;
+	}
+	uint64_t elapsed = frame - deck->at;
+	if (elapsed >= deck->scheduler->ramp) {
+		return deck->to;
+	}
+	return deck->from + (deck->to - deck->from) * elapsed / (float)deck->scheduler->ramp;
+}
+
+bool IsDeckRamping(struct Deck* deck, uint64_t start, unsigned int samples) {
+	return start + samples > deck->at && start < deck->at + deck->scheduler->ramp;
+}
+
+void UpdateDeckState(struct Deck* deck, uint64_t end, unsigned int samples) {
+	// `samples` stands for the next block; a deck only counts as waiting when it stays silent through it,
+	// as that's the earliest a change made by the main thread in the meantime gets mixed.
+	enum DeckState state = DECK_FADING;
+	bool settled = end >= deck->at + deck->scheduler->ramp;
+	if (deck->to == 0.0) {
+		if (settled || deck->from == 0.0) {
+			state = DECK_SILENT;
+		}
+	} else if (settled) {
+		state = DECK_PLAYING;
+	} else if (deck->from == 0.0 && end + samples <= deck->at) {
+		state = DECK_WAITING;
+	}
+	atomic_store_explicit(&deck->state, state, memory_order_relaxed);
+}
+
+enum DeckState GetDeckState(struct Deck* deck) {
+	// Until the audio thread has taken everything sent its way, the state it reports is about to change.
+	struct Scheduler* scheduler = deck->scheduler;
+	if (atomic_load_explicit(&scheduler->reset_seen, memory_order_acquire) != atomic_load_explicit(&scheduler->reset, memory_order_relaxed) ||
+		atomic_load_explicit(&deck->applied, memory_order_acquire) != deck->posted) {
+		return DECK_PENDING;
+	}
+	return atomic_load_explicit(&deck->state, memory_order_relaxed);
+}
+
+void ApplyDeckGain(struct Deck* deck, float* buffer, unsigned int samples, uint64_t start) {
+	float* data = buffer;
+	if (!IsDeckRamping(deck, start, samples)) {
+		float gain = GetDeckGain(deck, start);
+		if (gain != 1.0) {
+			unsigned int i = 0;
+			for (; i + 4 <= samples * 2; i += 4) {
+				v4sf_store(data + i, v4sf_load(data + i) * v4sf_set1(gain));
+			}
+			for (; i < samples * 2; i++) {
+				data[i] *= gain;
+			}
+		}
+	} else {
+		for (unsigned int i = 0; i < samples; i++) {
+			float gain = GetDeckGain(deck, start + i);
+			data[i * 2] *= gain;
+			data[i * 2 + 1] *= gain;
+		}
+	}
+}
+
+static void DeckPostprocess(void* buffer, unsigned int samples, void* userdata) {
+	struct Deck* deck = userdata;
+	UpdateScheduler(deck->scheduler, samples);
+	uint64_t start = atomic_load_explicit(&deck->scheduler->transport->frames, memory_order_relaxed);
+	ApplyDeckGain(deck, buffer, samples, start);
+	UpdateDeckState(deck, start + samples, samples);
+}
+
+static uint64_t GetBoundary(struct Scheduler* scheduler, uint64_t frame, enum Quantum quantum) {
+	if (quantum == QUANTUM_NONE) {
+		return frame;
+	}
+	struct Transport* transport = scheduler->transport;
+	double beats = quantum == QUANTUM_BAR ? transport->bar : 1;
+	double period = transport->length * beats / transport->beats * scheduler->frequency / transport->frequency;
+	double elapsed = (int64_t)(frame - transport->origin);
+	uint64_t boundary = transport->origin + (int64_t)llround(ceil(elapsed / period) * period);
+	return boundary > frame ? boundary : frame;
+}
+
+static void SetDeckTarget(struct Deck* deck, uint64_t at, float to) {
+	// Starts from wherever the previous envelope would be by then, so overriding one that's
+	// still waiting for its boundary or ramping doesn't jump.
+	deck->from = GetDeckGain(deck, at);
+	deck->to = to;
+	deck->at = at;
+}
+
+static void HoldDeck(struct Deck* deck, uint64_t frame) {
+	deck->from = deck->to = GetDeckGain(deck, frame);
+	deck->at = 0;
+}
+
+static void CancelSwitch(struct Scheduler* scheduler, struct SchedulerCommand* command, uint64_t frame) {
+	// Only while the incoming deck is still silent for the whole block, so nothing that's
+	// already audible changes; otherwise the switch goes on and the main thread waits for it.
+	struct Deck* in = &scheduler->decks[command->in];
+	if (in->to == 0.0 || in->from != 0.0 || in->at < frame) {
+		return;
+	}
+	HoldDeck(in, frame);
+	if (command->out >= 0) {
+		HoldDeck(&scheduler->decks[command->out], frame);
+	}
+}
+
+static void FinishCommand(struct Scheduler* scheduler, int deck, uint64_t frame, unsigned int samples) {
+	if (deck >= 0) {
+		UpdateDeckState(&scheduler->decks[deck], frame, samples);
+		atomic_fetch_add_explicit(&scheduler->decks[deck].applied, 1, memory_order_release);
+	}
+}
+
+void UpdateScheduler(struct Scheduler* scheduler, unsigned int samples) {
+	// Called by every deck before it applies its gain, while `frames` points at the block's start;
+	// only the first call of a block does anything, whichever order Allegro mixes the decks in.
+	struct Transport* transport = scheduler->transport;
+	uint64_t frame = atomic_load_explicit(&transport->frames, memory_order_relaxed);
+	if (frame == scheduler->updated) {
+		return;
+	}
+	scheduler->updated = frame;
+
+	unsigned int reset = atomic_load_explicit(&scheduler->reset, memory_order_acquire);
+	if (reset != scheduler->reset_seen) {
+		for (int i = 0; i < scheduler->count; i++) {
+			scheduler->decks[i].from = 0.0;
+			scheduler->decks[i].to = 0.0;
+			scheduler->decks[i].at = 0;
+			atomic_store_explicit(&scheduler->decks[i].state, DECK_SILENT, memory_order_relaxed);
+		}
+		atomic_store_explicit(&scheduler->reset_seen, reset, memory_order_release);
+	}
+
+	unsigned int read = atomic_load_explicit(&scheduler->read, memory_order_relaxed);
+	unsigned int write = atomic_load_explicit(&scheduler->write, memory_order_acquire);
+	if (read == write) {
+		return;
+	}
+
+	double now = al_get_time();
+	double latency = (transport->latency ? transport->latency : samples * 2.0) / scheduler->frequency; // as in the transport
+
+	BeginSeqlockWrite(&scheduler->sequence);
+
+	for (; read != write; read++) {
+		struct SchedulerCommand* command = &scheduler->ring[read & (scheduler->size - 1)];
+		if (command->cancel) {
+			CancelSwitch(scheduler, command, frame);
+			FinishCommand(scheduler, command->in, frame, samples);
+			FinishCommand(scheduler, command->out, frame, samples);
+			continue;
+		}
+		uint64_t at = GetBoundary(scheduler, frame, command->quantum);
+		if (command->in >= 0) {
+			SetDeckTarget(&scheduler->decks[command->in], at, 1.0);
+		}
+		if (command->out >= 0) {
+			SetDeckTarget(&scheduler->decks[command->out], at, 0.0);
+		}
+		FinishCommand(scheduler, command->in, frame, samples);
+		FinishCommand(scheduler, command->out, frame, samples);
+
+		struct SchedulerStats* stats = &scheduler->stats;
+		double waited = now - command->time;
+		uint64_t requested = frame - (uint64_t)fmin(frame, fmax(0.0, waited * scheduler->frequency));
+		if (command->quantum != QUANTUM_NONE && GetBoundary(scheduler, requested, command->quantum) < frame) {
+			stats->late++;
+		}
+		stats->switches++;
+		stats->latency_total += waited + latency;
+		if (waited + latency > stats->latency_max) {
+			stats->latency_max = waited + latency;
+		}
+	}
+
+	EndSeqlockWrite(&scheduler->sequence);
+	atomic_store_explicit(&scheduler->read, read, memory_order_release);
+}
+
+struct Scheduler* CreateScheduler(struct Game* game, struct Transport* transport, int decks) {
+	struct Scheduler* scheduler = calloc(1, sizeof(struct Scheduler) + sizeof(struct Deck) * decks);
+	atomic_init(&scheduler->write, 0);
+	atomic_init(&scheduler->read, 0);
+	atomic_init(&scheduler->sequence, 0);
+	atomic_init(&scheduler->reset, 0);
+	atomic_init(&scheduler->reset_seen, 0);
+	scheduler->size = SCHEDULER_RING;
+	while (scheduler->size < (unsigned int)decks) {
+		scheduler->size *= 2;
+	}
+	scheduler->ring = calloc(scheduler->size, sizeof(struct SchedulerCommand));
+	scheduler->transport = transport;
+	scheduler->frequency = al_get_mixer_frequency(transport->mixer);
+	scheduler->ramp = SCHEDULER_RAMP * scheduler->frequency;
+	scheduler->count = decks;
+	scheduler->updated = UINT64_MAX;
+	return scheduler;
+}
+
+void DestroyScheduler(struct Scheduler* scheduler) {
+	for (int i = 0; i < scheduler->count; i++) {
+		if (scheduler->decks[i].mixer) {
+			al_destroy_mixer(scheduler->decks[i].mixer);
+		}
+	}
+	free(scheduler->ring);
+	free(scheduler);
+}
+
+void InitDeck(struct Scheduler* scheduler, int deck, ALLEGRO_MIXER* parent) {
+	struct Deck* d = &scheduler->decks[deck];
+	d->scheduler = scheduler;
+	d->from = 0.0;
+	d->to = 0.0;
+	d->at = 0;
+	atomic_init(&d->state, DECK_SILENT);
+	atomic_init(&d->applied, 0);
+	d->loop = NULL;
+	d->posted = 0;
+	if (!parent) {
+		return; // played by something else, which applies the gain by itself
+	}
+	d->mixer = al_create_mixer(scheduler->frequency, ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
+	al_set_mixer_postprocess_callback(d->mixer, DeckPostprocess, d);
+	al_attach_mixer_to_mixer(d->mixer, parent);
+}
+
+bool IsSchedulerFull(struct Scheduler* scheduler) {
+	unsigned int write = atomic_load_explicit(&scheduler->write, memory_order_relaxed);
+	return write - atomic_load_explicit(&scheduler->read, memory_order_acquire) >= scheduler->size;
+}
+
+static bool PushCommand(struct Scheduler* scheduler, struct SchedulerCommand command) {
+	if (IsSchedulerFull(scheduler)) {
+		return false;
+	}
+	unsigned int write = atomic_load_explicit(&scheduler->write, memory_order_relaxed);
+	scheduler->ring[write & (scheduler->size - 1)] = command;
+	if (command.in >= 0) {
+		scheduler->decks[command.in].posted++;
+	}
+	if (command.out >= 0) {
+		scheduler->decks[command.out].posted++;
+	}
+	atomic_store_explicit(&scheduler->write, write + 1, memory_order_release);
+	return true;
+}
+
+bool PostSchedulerCommand(struct Scheduler* scheduler, int in, int out, enum Quantum quantum, double time) {
+	return PushCommand(scheduler, (struct SchedulerCommand){.in = in, .out = out, .quantum = quantum, .time = time});
+}
+
+bool CancelSchedulerSwitch(struct Scheduler* scheduler, int in, int out) {
+	// Whether it worked shows in the decks' state once the audio thread has taken it.
+	return PushCommand(scheduler, (struct SchedulerCommand){.in = in, .out = out, .cancel = true});
+}
+
+void ResetScheduler(struct Scheduler* scheduler) {
+	atomic_fetch_add_explicit(&scheduler->reset, 1, memory_order_release);
+}
+
+enum Quantum ParseQuantum(const char* name) {
+	if (strcmp(name, "beat") == 0) {
+		return QUANTUM_BEAT;
+	}
+	if (strcmp(name, "bar") == 0) {
+		return QUANTUM_BAR;
+	}
+	return QUANTUM_NONE;
+}
+
+void ReadSchedulerStats(struct Scheduler* scheduler, struct SchedulerStats* stats) {
+	unsigned int before;
+	do {
+		before = BeginSeqlockRead(&scheduler->sequence);
+		memcpy(stats, &scheduler->stats, sizeof(struct SchedulerStats));
+	} while (RetrySeqlockRead(&scheduler->sequence, before));
+}
+
+void PrintSchedulerStats(struct Game* game, struct Scheduler* scheduler) {
+	struct SchedulerStats stats;
+	ReadSchedulerStats(scheduler, &stats);
+	if (!stats.switches) {
+		return;
+	}
+	PrintConsole(game, "switches: %u, input to sound avg %.1f ms, max %.1f ms (without quantization); %u late",
+		stats.switches, stats.latency_total / stats.switches * 1000.0, stats.latency_max * 1000.0, stats.late);
+}
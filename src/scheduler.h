@@ -0,0 +1,127 @@
+/*! \file scheduler.h
+ *  \brief Loop switches applied by the audio thread at exact frames.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_SCHEDULER_H
+#define POTATOES_SCHEDULER_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define SCHEDULER_RING 256 // queued commands at least; a power of two
+#define SCHEDULER_RAMP 0.005 // length of the gain ramps, in seconds
+
+struct Game;
+struct Loop;
+struct Transport;
+
+enum Quantum {
+	QUANTUM_NONE, // at the start of the next mixed buffer
+	QUANTUM_BEAT,
+	QUANTUM_BAR,
+};
+
+enum DeckState {
+	DECK_SILENT, // the envelope has settled at zero, so whatever plays there can be detached
+	DECK_WAITING, // silent until a fade-in past the next block, so the switch can still be cancelled
+	DECK_FADING,
+	DECK_PLAYING, // settled at full gain
+	DECK_PENDING, // seen from the main thread: the audio thread hasn't taken all commands for the deck yet
+};
+
+/*! \brief Mixer with a gain envelope applied on the audio thread.
+ *
+ * Every potato has two decks, so an incoming loop can play silently in sync on one of them
+ * while the other one is still audible, and both gains can change at the same frame.
+ */
+struct Deck {
+	ALLEGRO_MIXER* mixer; // NULL when the deck gets mixed by the engine
+	struct Scheduler* scheduler;
+
+	// audio thread only; the gain ramps from `from` to `to`, starting at transport frame `at`
+	float from, to;
+	uint64_t at;
+
+	atomic_int state; // enum DeckState as of the end of the last mixed block
+	atomic_uint applied; // commands for the deck taken by the audio thread
+
+	// main thread only
+	struct Loop* loop;
+	unsigned int posted; // commands posted for the deck
+};
+
+struct SchedulerCommand {
+	int in, out; // decks to fade in and out; -1 for none
+	enum Quantum quantum;
+	double time; // when the input that caused it happened
+	bool cancel; // hold both decks where they are instead, if `in` is still waiting for its fade-in
+};
+
+struct SchedulerStats {
+	unsigned int switches;
+	unsigned int late; // quantized switches that missed the boundary that was next when requested
+	double latency_total, latency_max; // from input to being heard, not counting the wait for the boundary
+};
+
+/*! \brief Lock-free queue of deck switches from the main thread to the audio thread.
+ *
+ * The first deck that gets mixed in a block drains the queue, so the commands are in place
+ * before any gain gets applied without relying on the order Allegro mixes its inputs in. Each
+ * command is resolved to a transport frame there, and decks apply their envelopes sample by sample.
+ * Stats are handed back to the main thread through a seqlock.
+ */
+struct Scheduler {
+	struct Transport* transport;
+	unsigned int frequency; // of the transport mixer
+	unsigned int ramp; // in frames
+
+	struct SchedulerCommand* ring;
+	unsigned int size; // of the ring; holds a command for every deck, so a caller that waits for its decks never finds it full
+	atomic_uint write, read;
+	atomic_uint reset; // bumped to silence every deck at once
+	atomic_uint reset_seen;
+	uint64_t updated; // audio thread only; transport frame of the block the queue was last drained for
+
+	atomic_uint sequence;
+	struct SchedulerStats stats;
+
+	int count;
+	struct Deck decks[];
+};
+
+struct Scheduler* CreateScheduler(struct Game* game, struct Transport* transport, int decks);
+void DestroyScheduler(struct Scheduler* scheduler);
+void InitDeck(struct Scheduler* scheduler, int deck, ALLEGRO_MIXER* parent);
+void UpdateScheduler(struct Scheduler* scheduler, unsigned int samples);
+float GetDeckGain(struct Deck* deck, uint64_t frame);
+bool IsDeckRamping(struct Deck* deck, uint64_t start, unsigned int samples);
+void ApplyDeckGain(struct Deck* deck, float* buffer, unsigned int samples, uint64_t start);
+void UpdateDeckState(struct Deck* deck, uint64_t end, unsigned int samples);
+enum DeckState GetDeckState(struct Deck* deck);
+void ResetScheduler(struct Scheduler* scheduler);
+bool IsSchedulerFull(struct Scheduler* scheduler);
+bool PostSchedulerCommand(struct Scheduler* scheduler, int in, int out, enum Quantum quantum, double time);
+bool CancelSchedulerSwitch(struct Scheduler* scheduler, int in, int out);
+enum Quantum ParseQuantum(const char* name);
+void ReadSchedulerStats(struct Scheduler* scheduler, struct SchedulerStats* stats);
+void PrintSchedulerStats(struct Game* game, struct Scheduler* scheduler);
+
+#endif
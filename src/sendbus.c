@@ -0,0 +1,176 @@
+/*! \file sendbus.c
+ *  \brief Shared reverb and EQ the potatoes send into.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "sendbus.h"
+#include "simd.h"
+#include <libsuperderpy.h>
+
+// Mutually prime-ish, so echoes of the lines don't line up.
+static const double LineTimes[SENDBUS_LINES] = {0.0297, 0.0371, 0.0411, 0.0437, 0.0533, 0.0593, 0.0671, 0.0737};
+
+// Input and output taps with different signs for every line keep the two channels decorrelated.
+static const float InputTaps[SENDBUS_LINES] = {0.5, -0.5, 0.5, 0.5, -0.5, 0.5, -0.5, -0.5};
+static const float LeftTaps[SENDBUS_LINES] = {0.5, -0.5, 0.5, -0.5, 0.5, -0.5, 0.5, -0.5};
+static const float RightTaps[SENDBUS_LINES] = {0.5, 0.5, -0.5, -0.5, 0.5, 0.5, -0.5, -0.5};
+
+// Keeps the feedback loop out of denormals once the input goes silent; the low cut removes it.
+#define SENDBUS_DENORMAL 1e-18f
+
+static inline v4sf Hadamard4(v4sf x) {
+	v4sf p = {x[0] + x[1], x[0] - x[1], x[2] + x[3], x[2] - x[3]};
+	return (v4sf){p[0] + p[2], p[1] + p[3], p[0] - p[2], p[1] - p[3]};
+}
+
+static void InitHighPass(struct Biquad* biquad, double frequency, double cutoff) {
+	// Butterworth, from the Audio EQ Cookbook.
+	double w = 2.0 * ALLEGRO_PI * cutoff / frequency;
+	double alpha = sin(w) / (2.0 * M_SQRT1_2);
+	double a0 = 1.0 + alpha;
+	biquad->b0 = (1.0 + cos(w)) / 2.0 / a0;
+	biquad->b1 = -(1.0 + cos(w)) / a0;
+	biquad->b2 = biquad->b0;
+	biquad->a1 = -2.0 * cos(w) / a0;
+	biquad->a2 = (1.0 - alpha) / a0;
+}
+
+static void InitHighShelf(struct Biquad* biquad, double frequency, double cutoff, double gain) {
+	// Shelf slope of 1, from the Audio EQ Cookbook.
+	double a = pow(10.0, gain / 40.0);
+	double w = 2.0 * ALLEGRO_PI * cutoff / frequency;
+	double beta = 2.0 * sqrt(a) * sin(w) / 2.0 * M_SQRT2;
+	double a0 = (a + 1.0) - (a - 1.0) * cos(w) + beta;
+	biquad->b0 = a * ((a + 1.0) + (a - 1.0) * cos(w) + beta) / a0;
+	biquad->b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cos(w)) / a0;
+	biquad->b2 = a * ((a + 1.0) + (a - 1.0) * cos(w) - beta) / a0;
+	biquad->a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cos(w)) / a0;
+	biquad->a2 = ((a + 1.0) - (a - 1.0) * cos(w) - beta) / a0;
+}
+
+static inline v4sf RunBiquad(struct Biquad* biquad, v4sf x, v4sf* z1, v4sf* z2) {
+	v4sf y = x * biquad->b0 + *z1;
+	*z1 = x * biquad->b1 - y * biquad->a1 + *z2;
+	*z2 = x * biquad->b2 - y * biquad->a2;
+	return y;
+}
+
+struct SendBus* CreateSendBus(unsigned int frequency, int stage) {
+	struct SendBus* bus = calloc(1, sizeof(struct SendBus));
+	bus->frequency = frequency;
+	bus->stage = stage;
+
+	unsigned int total = 0;
+	for (int i = 0; i < SENDBUS_LINES; i++) {
+		bus->start[i] = total;
+		bus->length[i] = LineTimes[i] * frequency;
+		bus->gain[i] = pow(10.0, -3.0 * bus->length[i] / (frequency * SENDBUS_DECAY));
+		total += bus->length[i];
+	}
+	bus->lines = calloc(total, sizeof(float));
+	bus->damping = 1.0 - exp(-2.0 * ALLEGRO_PI * SENDBUS_DAMPING / frequency);
+
+	InitHighPass(&bus->lowcut, frequency, SENDBUS_LOWCUT);
+	InitHighShelf(&bus->shelf, frequency, SENDBUS_SHELF, SENDBUS_SHELF_GAIN);
+	return bus;
+}
+
+void DestroySendBus(struct SendBus* bus) {
+	free(bus->lines);
+	free(bus);
+}
+
+void SendToBus(struct SendBus* bus, const float* buffer, unsigned int samples, unsigned int offset, float level) {
+	// Called on the audio thread for every potato that's mixed, before the bus gets processed.
+	if (level <= 0.0 || offset >= SENDBUS_FRAMES) {
+		return;
+	}
+	if (offset + samples > SENDBUS_FRAMES) {
+		samples = SENDBUS_FRAMES - offset;
+	}
+	float* input = bus->input + offset * 2;
+	unsigned int i = 0;
+	v4sf gain = v4sf_set1(level);
+	for (; i + 4 <= samples * 2; i += 4) {
+		v4sf_store(input + i, v4sf_load(input + i) + v4sf_load(buffer + i) * gain);
+	}
+	for (; i < samples * 2; i++) {
+		input[i] += buffer[i] * level;
+	}
+	if (offset + samples > bus->collected) {
+		bus->collected = offset + samples;
+	}
+}
+
+void ProcessSendBus(struct SendBus* bus, float* buffer, unsigned int samples) {
+	// Adds the reverb of whatever got sent during this buffer to it, then clears the input.
+	v4sf in_a = v4sf_load(InputTaps), in_b = v4sf_load(InputTaps + 4);
+	v4sf left_a = v4sf_load(LeftTaps), left_b = v4sf_load(LeftTaps + 4);
+	v4sf right_a = v4sf_load(RightTaps), right_b = v4sf_load(RightTaps + 4);
+	v4sf gain_a = v4sf_load(bus->gain), gain_b = v4sf_load(bus->gain + 4);
+	v4sf lp_a = v4sf_load(bus->lowpass), lp_b = v4sf_load(bus->lowpass + 4);
+	v4sf damping = v4sf_set1(bus->damping);
+	v4sf scale = v4sf_set1(M_SQRT1_2 / 2.0); // normalizes the 8x8 Hadamard matrix
+	v4sf low1 = v4sf_load(bus->lowcut.z1), low2 = v4sf_load(bus->lowcut.z2);
+	v4sf shelf1 = v4sf_load(bus->shelf.z1), shelf2 = v4sf_load(bus->shelf.z2);
+
+	for (unsigned int i = 0; i < samples; i++) {
+		float x = SENDBUS_DENORMAL;
+		if (i < bus->collected) {
+			x += (bus->input[i * 2] + bus->input[i * 2 + 1]) * 0.5f;
+		}
+
+		float out[SENDBUS_LINES];
+		for (int k = 0; k < SENDBUS_LINES; k++) {
+			out[k] = bus->lines[bus->start[k] + bus->position[k]];
+		}
+		v4sf a = v4sf_load(out), b = v4sf_load(out + 4);
+		lp_a += (a - lp_a) * damping;
+		lp_b += (b - lp_b) * damping;
+		a = lp_a * gain_a;
+		b = lp_b * gain_b;
+
+		v4sf wet = {v4sf_sum(a * left_a + b * left_b), v4sf_sum(a * right_a + b * right_b), 0.0f, 0.0f};
+		wet = RunBiquad(&bus->lowcut, wet, &low1, &low2);
+		wet = RunBiquad(&bus->shelf, wet, &shelf1, &shelf2);
+		buffer[i * 2] += wet[0] * SENDBUS_RETURN;
+		buffer[i * 2 + 1] += wet[1] * SENDBUS_RETURN;
+
+		v4sf ha = Hadamard4(a), hb = Hadamard4(b);
+		v4sf input = v4sf_set1(x);
+		v4sf_store(out, (ha + hb) * scale + input * in_a);
+		v4sf_store(out + 4, (ha - hb) * scale + input * in_b);
+		for (int k = 0; k < SENDBUS_LINES; k++) {
+			bus->lines[bus->start[k] + bus->position[k]] = out[k];
+			if (++bus->position[k] == bus->length[k]) {
+				bus->position[k] = 0;
+			}
+		}
+	}
+
+	v4sf_store(bus->lowpass, lp_a);
+	v4sf_store(bus->lowpass + 4, lp_b);
+	v4sf_store(bus->lowcut.z1, low1);
+	v4sf_store(bus->lowcut.z2, low2);
+	v4sf_store(bus->shelf.z1, shelf1);
+	v4sf_store(bus->shelf.z2, shelf2);
+
+	memset(bus->input, 0, sizeof(float) * bus->collected * 2);
+	bus->collected = 0;
+}
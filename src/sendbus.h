@@ -0,0 +1,71 @@
+/*! \file sendbus.h
+ *  \brief Shared reverb and EQ the potatoes send into.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_SENDBUS_H
+#define POTATOES_SENDBUS_H
+
+#include <allegro5/allegro.h>
+
+#define SENDBUS_FRAMES 8192 // longest buffer the sends get collected for; anything past it is dry
+#define SENDBUS_LINES 8 // delay lines of the reverb, two vectors' worth
+#define SENDBUS_DECAY 1.8 // reverb time (RT60), in seconds
+#define SENDBUS_DAMPING 5000.0 // cutoff of the damping in the feedback loop, in Hz
+#define SENDBUS_LOWCUT 180.0 // high-pass on the return, in Hz
+#define SENDBUS_SHELF 4000.0 // high shelf on the return, in Hz
+#define SENDBUS_SHELF_GAIN -4.0 // in dB
+#define SENDBUS_RETURN 0.7 // level of the wet signal
+
+struct Biquad {
+	float b0, b1, b2, a1, a2;
+	float z1[4], z2[4]; // left and right in the first two lanes
+};
+
+/*! \brief One reverb for the whole choir, fed by per-potato sends.
+ *
+ * Potatoes add a scaled copy of their mix into the bus input while they get mixed, and the bus
+ * is processed once per buffer on top of everything else (from the transport's postprocess
+ * callback), so its cost doesn't depend on how many potatoes are singing.
+ *
+ * The reverb is a feedback delay network of eight lines with a Hadamard feedback matrix and
+ * damping in the loop, processed as two vectors of four lines; its return is EQ'd with
+ * a low cut and a high shelf, both channels at once.
+ */
+struct SendBus {
+	unsigned int frequency;
+	int stage; // deadline stage the bus is timed as
+
+	float input[SENDBUS_FRAMES * 2]; // sends of the buffer being mixed
+	unsigned int collected; // frames of `input` that have anything in them
+
+	float* lines; // all delay lines, one after another
+	unsigned int start[SENDBUS_LINES], length[SENDBUS_LINES], position[SENDBUS_LINES];
+	float gain[SENDBUS_LINES]; // per pass through the line, for the decay time
+	float lowpass[SENDBUS_LINES]; // damping filter state
+	float damping;
+
+	struct Biquad lowcut, shelf;
+};
+
+struct SendBus* CreateSendBus(unsigned int frequency, int stage);
+void DestroySendBus(struct SendBus* bus);
+void SendToBus(struct SendBus* bus, const float* buffer, unsigned int samples, unsigned int offset, float level);
+void ProcessSendBus(struct SendBus* bus, float* buffer, unsigned int samples);
+
+#endif
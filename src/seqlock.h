@@ -0,0 +1,52 @@
+/*! \file seqlock.h
+ *  \brief Single-writer seqlock for handing snapshots from the audio thread over to the main one.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_SEQLOCK_H
+#define POTATOES_SEQLOCK_H
+
+#include <stdatomic.h>
+#include <stdbool.h>
+
+// The sequence is odd while the writer is in the middle of an update. Readers copy the guarded
+// data between BeginSeqlockRead() and RetrySeqlockRead() and start over whenever it changed.
+
+static inline void BeginSeqlockWrite(atomic_uint* sequence) {
+	// only ever written from one thread, so there's nothing to race with
+	unsigned int value = atomic_load_explicit(sequence, memory_order_relaxed);
+	atomic_store_explicit(sequence, value + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static inline void EndSeqlockWrite(atomic_uint* sequence) {
+	unsigned int value = atomic_load_explicit(sequence, memory_order_relaxed);
+	atomic_store_explicit(sequence, value + 1, memory_order_release);
+}
+
+static inline unsigned int BeginSeqlockRead(atomic_uint* sequence) {
+	return atomic_load_explicit(sequence, memory_order_acquire);
+}
+
+static inline bool RetrySeqlockRead(atomic_uint* sequence, unsigned int before) {
+	atomic_thread_fence(memory_order_acquire);
+	unsigned int after = atomic_load_explicit(sequence, memory_order_relaxed);
+	return before != after || (before & 1);
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*! \file simd.h
+ *  \brief Portable SIMD vector types.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_SIMD_H
+#define POTATOES_SIMD_H
+
+// GCC and Clang lower these to SSE, NEON or WebAssembly SIMD depending on the target,
+// and to plain scalar code where none is available.
+typedef float v4sf __attribute__((vector_size(16)));
+
+static inline v4sf v4sf_set1(float x) {
+	return (v4sf){x, x, x, x};
+}
+
+static inline v4sf v4sf_load(const float* ptr) {
+	v4sf v;
+	__builtin_memcpy(&v, ptr, sizeof(v));
+	return v;
+}
+
+static inline void v4sf_store(float* ptr, v4sf v) {
+	__builtin_memcpy(ptr, &v, sizeof(v));
+}
+
+static inline float v4sf_sum(v4sf v) {
+	return v[0] + v[1] + v[2] + v[3];
+}
+
+#endif
@@ -0,0 +1,126 @@
+/*! \file soundbank.c
+ *  \brief Cooked, uncompressed sound bank with the choir loops.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "soundbank.h"
+#include <libsuperderpy.h>
+
+#if !defined(_WIN32) && !defined(__EMSCRIPTEN__) && !defined(__vita__) && !defined(__SWITCH__)
+#define SOUNDBANK_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+struct SoundBank {
+	void* data;
+	size_t size;
+	bool mapped;
+	struct SoundBankHeader* header;
+	struct SoundBankEntry* entries;
+};
+
+static void* ReadWholeFile(const char* path, size_t* size) {
+	ALLEGRO_FILE* file = al_fopen(path, "rb");
+	if (!file) {
+		return NULL;
+	}
+	// streams of unknown size can't hold a bank anyway
+	int64_t length = al_fsize(file);
+	if (length < 0) {
+		al_fclose(file);
+		return NULL;
+	}
+	*size = length;
+	void* data = malloc(*size);
+	if (!data || al_fread(file, data, *size) != *size) {
+		free(data);
+		data = NULL;
+	}
+	al_fclose(file);
+	return data;
+}
+
+struct SoundBank* LoadSoundBank(const char* path) {
+	struct SoundBank* bank = calloc(1, sizeof(struct SoundBank));
+
+#ifdef SOUNDBANK_MMAP
+	int fd = open(path, O_RDONLY);
+	if (fd >= 0) {
+		struct stat st;
+		if (fstat(fd, &st) == 0) {
+			bank->size = st.st_size;
+			bank->data = mmap(NULL, bank->size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (bank->data == MAP_FAILED) {
+				bank->data = NULL;
+			} else {
+				bank->mapped = true;
+			}
+		}
+		close(fd);
+	}
+#endif
+
+	if (!bank->data) {
+		bank->data = ReadWholeFile(path, &bank->size);
+	}
+
+	bank->header = bank->data;
+	bank->entries = (struct SoundBankEntry*)(bank->header + 1);
+	if (!bank->data || bank->size < sizeof(struct SoundBankHeader) ||
+		memcmp(bank->header->magic, SOUNDBANK_MAGIC, 4) != 0 || bank->header->version != SOUNDBANK_VERSION ||
+		bank->size < sizeof(struct SoundBankHeader) + bank->header->count * sizeof(struct SoundBankEntry)) {
+		DestroySoundBank(bank);
+		return NULL;
+	}
+
+	size_t frame_size = al_get_channel_count(bank->header->channels) * al_get_audio_depth_size(bank->header->depth);
+	for (unsigned int i = 0; i < bank->header->count; i++) {
+		if (bank->entries[i].offset + bank->entries[i].frames * frame_size > bank->size) {
+			DestroySoundBank(bank);
+			return NULL;
+		}
+	}
+
+	return bank;
+}
+
+ALLEGRO_SAMPLE* CreateSoundBankSample(struct SoundBank* bank, const char* name) {
+	for (unsigned int i = 0; i < bank->header->count; i++) {
+		struct SoundBankEntry* entry = &bank->entries[i];
+		if (strncmp(entry->name, name, sizeof(entry->name)) == 0) {
+			// The sample points straight into the bank; Allegro never writes into sample data.
+			return al_create_sample((char*)bank->data + entry->offset, entry->frames, bank->header->frequency,
+				bank->header->depth, bank->header->channels, false);
+		}
+	}
+	return NULL;
+}
+
+void DestroySoundBank(struct SoundBank* bank) {
+#ifdef SOUNDBANK_MMAP
+	if (bank->mapped) {
+		munmap(bank->data, bank->size);
+		bank->data = NULL;
+	}
+#endif
+	free(bank->data);
+	free(bank);
+}
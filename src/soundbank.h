@@ -0,0 +1,60 @@
+/*! \file soundbank.h
+ *  \brief Cooked, uncompressed sound bank with the choir loops.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_SOUNDBANK_H
+#define POTATOES_SOUNDBANK_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+#include <stdint.h>
+
+#define SOUNDBANK_MAGIC "PTBK"
+#define SOUNDBANK_VERSION 1
+#define SOUNDBANK_ALIGNMENT 4096 // sample data offsets are page aligned, so they can be mapped as-is
+
+/*! \brief On-disk header of a sound bank. All fields are little endian.
+ *
+ * The header is followed by `count` entries, and then by the sample data
+ * that the entries point at.
+ */
+struct SoundBankHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t count;
+	uint32_t frequency;
+	uint32_t depth; // ALLEGRO_AUDIO_DEPTH
+	uint32_t channels; // ALLEGRO_CHANNEL_CONF
+	uint32_t reserved[2];
+};
+
+struct SoundBankEntry {
+	char name[48]; // data path without extension, e.g. "p0/1"
+	uint64_t offset; // from the start of the file
+	uint32_t frames;
+	uint32_t reserved;
+};
+
+struct SoundBank;
+
+struct SoundBank* LoadSoundBank(const char* path);
+ALLEGRO_SAMPLE* CreateSoundBankSample(struct SoundBank* bank, const char* name);
+void DestroySoundBank(struct SoundBank* bank);
+
+#endif
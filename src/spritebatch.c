@@ -0,0 +1,106 @@
+/*! \file spritebatch.c
+ *  \brief Batches textured quads into a single primitive draw call.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "spritebatch.h"
+#include <libsuperderpy.h>
+
+struct SpriteBatch* CreateSpriteBatch(void) {
+	return calloc(1, sizeof(struct SpriteBatch));
+}
+
+void FlushSpriteBatch(struct SpriteBatch* batch) {
+	if (batch->count) {
+		al_draw_prim(batch->vertices, NULL, batch->texture, 0, batch->count, ALLEGRO_PRIM_TRIANGLE_LIST);
+		batch->draws++;
+		if (batch->texture != batch->bound) {
+			batch->binds++;
+			batch->bound = batch->texture;
+		}
+	}
+	batch->count = 0;
+}
+
+void NoteSpriteBatchDraw(struct SpriteBatch* batch, ALLEGRO_BITMAP* texture) {
+	// For bitmaps drawn directly in between sprites: flushes the sprites that go below it and
+	// counts the draw, so the stats stay right and the next flush knows the texture has changed.
+	FlushSpriteBatch(batch);
+	batch->draws++;
+	if (texture != batch->bound) {
+		batch->binds++;
+		batch->bound = texture;
+	}
+}
+
+void AddSprite(struct SpriteBatch* batch, ALLEGRO_BITMAP* bitmap, ALLEGRO_COLOR tint, float cx, float cy, float dx, float dy,
+	float sx, float sy, float angle, int flags, const ALLEGRO_TRANSFORM* transform) {
+	// Same geometry as al_draw_tinted_scaled_rotated_bitmap: pivot (cx, cy) of the bitmap lands at (dx, dy).
+	ALLEGRO_BITMAP* texture = al_get_parent_bitmap(bitmap);
+	float u0 = 0, v0 = 0;
+	if (texture) {
+		u0 = al_get_bitmap_x(bitmap);
+		v0 = al_get_bitmap_y(bitmap);
+	} else {
+		texture = bitmap;
+	}
+
+	if (texture != batch->texture) {
+		FlushSpriteBatch(batch);
+		batch->texture = texture;
+	}
+
+	if (batch->count + 6 > batch->allocated) {
+		batch->allocated = batch->allocated ? batch->allocated * 2 : 96;
+		batch->vertices = realloc(batch->vertices, sizeof(ALLEGRO_VERTEX) * batch->allocated);
+	}
+
+	float w = al_get_bitmap_width(bitmap), h = al_get_bitmap_height(bitmap);
+	float c = cosf(angle), s = sinf(angle);
+	static const int corners[4][2] = {{0, 0}, {1, 0}, {1, 1}, {0, 1}};
+	ALLEGRO_VERTEX quad[4];
+	for (int i = 0; i < 4; i++) {
+		float px = corners[i][0] * w, py = corners[i][1] * h;
+		float x = (px - cx) * sx, y = (py - cy) * sy;
+		quad[i].x = x * c - y * s + dx;
+		quad[i].y = x * s + y * c + dy;
+		quad[i].z = 0;
+		if (transform) {
+			al_transform_coordinates(transform, &quad[i].x, &quad[i].y);
+		}
+		quad[i].u = u0 + ((flags & ALLEGRO_FLIP_HORIZONTAL) ? w - px : px);
+		quad[i].v = v0 + ((flags & ALLEGRO_FLIP_VERTICAL) ? h - py : py);
+		quad[i].color = tint;
+	}
+
+	static const int indices[6] = {0, 1, 2, 0, 2, 3};
+	for (int i = 0; i < 6; i++) {
+		batch->vertices[batch->count++] = quad[indices[i]];
+	}
+}
+
+void AddCenteredSprite(struct SpriteBatch* batch, ALLEGRO_BITMAP* bitmap, ALLEGRO_COLOR tint, float dx, float dy,
+	float sx, float sy, int flags, const ALLEGRO_TRANSFORM* transform) {
+	AddSprite(batch, bitmap, tint, al_get_bitmap_width(bitmap) / 2.0, al_get_bitmap_height(bitmap) / 2.0, dx, dy, sx, sy, 0, flags, transform);
+}
+
+void DestroySpriteBatch(struct SpriteBatch* batch) {
+	free(batch->vertices);
+	free(batch);
+}
@@ -0,0 +1,53 @@
+/*! \file spritebatch.h
+ *  \brief Batches textured quads into a single primitive draw call.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_SPRITEBATCH_H
+#define POTATOES_SPRITEBATCH_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_primitives.h>
+
+/*! \brief Vertex array of sprites sharing a single texture.
+ *
+ * Sprites are transformed on the CPU, so each of them can have its own transform
+ * without flushing the pipeline. Adding a sprite from a different texture flushes
+ * what's been collected so far.
+ */
+struct SpriteBatch {
+	ALLEGRO_VERTEX* vertices;
+	int count, allocated;
+	ALLEGRO_BITMAP* texture;
+	ALLEGRO_BITMAP* bound; // texture of the last draw call
+
+	// statistics, reset by whoever collects them
+	int draws; // draw calls issued
+	int binds; // draw calls that had to switch to another texture
+};
+
+struct SpriteBatch* CreateSpriteBatch(void);
+void AddSprite(struct SpriteBatch* batch, ALLEGRO_BITMAP* bitmap, ALLEGRO_COLOR tint, float cx, float cy, float dx, float dy,
+	float sx, float sy, float angle, int flags, const ALLEGRO_TRANSFORM* transform);
+void AddCenteredSprite(struct SpriteBatch* batch, ALLEGRO_BITMAP* bitmap, ALLEGRO_COLOR tint, float dx, float dy,
+	float sx, float sy, int flags, const ALLEGRO_TRANSFORM* transform);
+void FlushSpriteBatch(struct SpriteBatch* batch);
+void NoteSpriteBatchDraw(struct SpriteBatch* batch, ALLEGRO_BITMAP* texture);
+void DestroySpriteBatch(struct SpriteBatch* batch);
+
+#endif
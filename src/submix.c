@@ -0,0 +1,349 @@
+/*! \file submix.c
+ *  \brief Fork/join pool rendering submixes on worker threads.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE // for pthread_setaffinity_np
+#endif
+
+#include "common.h"
+#include "submix.h"
+#include "seqlock.h"
+#include "trace.h"
+#include <libsuperderpy.h>
+
+#ifdef __linux__
+#define SUBMIX_PIN
+#define SUBMIX_FUTEX
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+// Spare cores are rare on consoles and there are no real threads on the web, so it's opt-in there.
+#if defined(__EMSCRIPTEN__) || defined(__vita__) || defined(__SWITCH__)
+#define SUBMIX_DEFAULT "0"
+#else
+#define SUBMIX_DEFAULT "-1"
+#endif
+
+#define CLAIM(generation, jobs, next) ((uint64_t)(generation) << 32 | (uint64_t)(jobs) << 16 | (uint64_t)(next))
+#define CLAIM_GENERATION(claim) ((uint32_t)((claim) >> 32))
+#define CLAIM_JOBS(claim) ((int)(((claim) >> 16) & 0xffff))
+#define CLAIM_NEXT(claim) ((int)((claim) & 0xffff))
+
+#define JOB(generation, status) ((uint64_t)(generation) << 32 | (uint64_t)(status))
+#define JOB_STATUS(state) ((int)((state) & 0xffffffff))
+
+enum SubmixStatus {
+	JOB_OPEN,
+	JOB_CLAIMED, // being rendered by a worker
+	JOB_DONE, // by a worker
+	JOB_STUCK, // a worker is still in it from an earlier batch, so it's left to the audio thread
+	JOB_TAKEN, // rendered by the audio thread
+};
+
+static inline void Relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+static bool ClaimSubmixJob(struct SubmixPool* pool, uint32_t generation, int* index) {
+	uint_fast64_t claim = atomic_load_explicit(&pool->claim, memory_order_acquire);
+	do {
+		if (CLAIM_GENERATION(claim) != generation || CLAIM_NEXT(claim) >= CLAIM_JOBS(claim)) {
+			return false;
+		}
+	} while (!atomic_compare_exchange_weak_explicit(&pool->claim, &claim, claim + 1, memory_order_acq_rel, memory_order_acquire));
+	*index = CLAIM_NEXT(claim);
+	return true;
+}
+
+static void PinSubmixWorker(struct SubmixWorker* worker) {
+#ifdef SUBMIX_PIN
+	// Both are best effort: real-time scheduling usually needs privileges, and pinning may be
+	// restricted by the environment. The workers park when idle, so neither can lock up a core.
+	if (worker->cpu >= 0) {
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		CPU_SET(worker->cpu, &set);
+		pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	}
+	struct sched_param param = {.sched_priority = sched_get_priority_min(SCHED_FIFO)};
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+}
+
+static void ParkSubmixWorker(struct SubmixPool* pool, uint32_t seen, double timeout) {
+	// Returns once a batch newer than `seen` got published, or after `timeout` seconds unless it's 0.
+	atomic_fetch_add_explicit(&pool->parked, 1, memory_order_seq_cst);
+#ifdef SUBMIX_FUTEX
+	struct timespec ts = {.tv_sec = timeout, .tv_nsec = (timeout - (long)timeout) * 1000000000.0};
+	syscall(SYS_futex, (uint32_t*)&pool->wake, FUTEX_WAIT_PRIVATE, seen, timeout > 0.0 ? &ts : NULL, NULL, 0);
+#else
+	ALLEGRO_TIMEOUT until;
+	al_init_timeout(&until, timeout);
+	al_lock_mutex(pool->mutex);
+	while (atomic_load_explicit(&pool->wake, memory_order_seq_cst) == seen) {
+		if (timeout <= 0.0) {
+			al_wait_cond(pool->cond, pool->mutex);
+		} else if (al_wait_cond_until(pool->cond, pool->mutex, &until)) {
+			break;
+		}
+	}
+	al_unlock_mutex(pool->mutex);
+#endif
+	atomic_fetch_sub_explicit(&pool->parked, 1, memory_order_relaxed);
+}
+
+static void WakeSubmixWorkers(struct SubmixPool* pool) {
+#ifdef SUBMIX_FUTEX
+	syscall(SYS_futex, (uint32_t*)&pool->wake, FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+#else
+	al_lock_mutex(pool->mutex);
+	al_broadcast_cond(pool->cond);
+	al_unlock_mutex(pool->mutex);
+#endif
+}
+
+static void* SubmixThread(ALLEGRO_THREAD* thread, void* arg) {
+	struct SubmixWorker* worker = arg;
+	struct SubmixPool* pool = worker->pool;
+	PinSubmixWorker(worker);
+	SetTraceThreadName("submix");
+
+	uint32_t seen = CLAIM_GENERATION(atomic_load_explicit(&pool->claim, memory_order_acquire));
+	double last = 0.0, period = 0.0; // when the last batch was noticed, and how far apart they come
+	while (!atomic_load_explicit(&pool->quit, memory_order_relaxed)) {
+		uint32_t generation = CLAIM_GENERATION(atomic_load_explicit(&pool->claim, memory_order_acquire));
+		if (generation == seen) {
+			// Buffers come in at a steady pace, so the worker sleeps until the next one is about due
+			// and then spins for a moment. When it doesn't show up in time, the worker parks until
+			// woken up; waking up late costs nothing but the audio thread rendering our share itself.
+			double now = al_get_time();
+			double due = last + period;
+			if (period > 0.0 && now < due - SUBMIX_WINDOW) {
+				ParkSubmixWorker(pool, seen, due - SUBMIX_WINDOW - now);
+			} else if (period > 0.0 && now < due + SUBMIX_WINDOW) {
+				Relax();
+			} else {
+				ParkSubmixWorker(pool, seen, 0.0);
+			}
+			continue;
+		}
+		double now = al_get_time();
+		period = generation == seen + 1 ? now - last : 0.0;
+		last = now;
+		seen = generation;
+
+		int index;
+		while (ClaimSubmixJob(pool, generation, &index)) {
+			// Entering the job before taking it keeps the audio thread from handing it to another
+			// worker in a later batch while this one is still in there.
+			struct SubmixJob* job = &pool->jobs[index];
+			atomic_fetch_add_explicit(&job->busy, 1, memory_order_seq_cst);
+			uint_fast64_t state = JOB(generation, JOB_OPEN);
+			if (atomic_compare_exchange_strong_explicit(&job->state, &state, JOB(generation, JOB_CLAIMED), memory_order_seq_cst, memory_order_relaxed)) {
+				pool->job(pool->userdata, index, SUBMIX_LANE_WORKER, true);
+				// Fails when the audio thread gave up waiting, and the result stays unused.
+				state = JOB(generation, JOB_CLAIMED);
+				atomic_compare_exchange_strong_explicit(&job->state, &state, JOB(generation, JOB_DONE), memory_order_release, memory_order_relaxed);
+			}
+			atomic_fetch_sub_explicit(&job->busy, 1, memory_order_release);
+		}
+	}
+	ReleaseTraceThread();
+	return NULL;
+}
+
+struct SubmixPool* CreateSubmixPool(int threads, int jobs, void (*job)(void* userdata, int index, int lane, bool owner), void* userdata) {
+	struct SubmixPool* pool = calloc(1, sizeof(struct SubmixPool) + sizeof(struct SubmixWorker) * threads);
+	pool->job = job;
+	pool->userdata = userdata;
+	atomic_init(&pool->claim, CLAIM(0, 0, 0));
+	pool->jobs = calloc(jobs, sizeof(struct SubmixJob));
+	for (int i = 0; i < jobs; i++) {
+		atomic_init(&pool->jobs[i].state, JOB(0, JOB_DONE));
+		atomic_init(&pool->jobs[i].busy, 0);
+	}
+	atomic_init(&pool->quit, false);
+	atomic_init(&pool->sequence, 0);
+	atomic_init(&pool->wake, 0);
+	atomic_init(&pool->parked, 0);
+#ifndef SUBMIX_FUTEX
+	pool->mutex = al_create_mutex();
+	pool->cond = al_create_cond();
+#endif
+
+	// The workers take the cores after the first one, where the main and audio threads usually live.
+	int cpus = al_get_cpu_count();
+	for (int i = 0; i < threads; i++) {
+		struct SubmixWorker* worker = &pool->workers[pool->count];
+		worker->pool = pool;
+		worker->cpu = cpus > 1 ? (i + 1) % cpus : -1;
+		worker->thread = al_create_thread(SubmixThread, worker);
+		if (!worker->thread) {
+			break;
+		}
+		pool->count++;
+		al_start_thread(worker->thread);
+	}
+	return pool;
+}
+
+void DestroySubmixPool(struct SubmixPool* pool) {
+	// The audio thread must not be running a batch anymore.
+	atomic_store_explicit(&pool->quit, true, memory_order_relaxed);
+	atomic_fetch_add_explicit(&pool->wake, 1, memory_order_seq_cst);
+	WakeSubmixWorkers(pool);
+	for (int i = 0; i < pool->count; i++) {
+		al_join_thread(pool->workers[i].thread, NULL);
+		al_destroy_thread(pool->workers[i].thread);
+	}
+#ifndef SUBMIX_FUTEX
+	al_destroy_cond(pool->cond);
+	al_destroy_mutex(pool->mutex);
+#endif
+	free(pool->jobs);
+	free(pool);
+}
+
+static bool TakeSubmixJob(struct SubmixPool* pool, int index, uint_fast64_t state) {
+	// Renders the job on the audio thread unless somebody changed its state in the meantime.
+	struct SubmixJob* job = &pool->jobs[index];
+	if (!atomic_compare_exchange_strong_explicit(&job->state, &state, JOB(pool->generation, JOB_TAKEN), memory_order_seq_cst, memory_order_relaxed)) {
+		return false;
+	}
+	pool->job(pool->userdata, index, SUBMIX_LANE_AUDIO, atomic_load_explicit(&job->busy, memory_order_seq_cst) == 0);
+	return true;
+}
+
+void RunSubmixJobs(struct SubmixPool* pool, int jobs, double wait) {
+	// Called from the audio thread; whatever the jobs read has to be set up before the call.
+	// Waits for workers that are in the middle of a job for `wait` seconds at most.
+	uint32_t generation = ++pool->generation;
+	for (int i = 0; i < jobs; i++) {
+		bool stuck = atomic_load_explicit(&pool->jobs[i].busy, memory_order_seq_cst) > 0;
+		atomic_store_explicit(&pool->jobs[i].state, JOB(generation, stuck ? JOB_STUCK : JOB_OPEN), memory_order_seq_cst);
+	}
+	atomic_store_explicit(&pool->claim, CLAIM(generation, jobs, 0), memory_order_release);
+	atomic_store_explicit(&pool->wake, generation, memory_order_seq_cst);
+	if (atomic_load_explicit(&pool->parked, memory_order_seq_cst)) {
+		WakeSubmixWorkers(pool); // a single syscall with futexes, and a lock only parked workers contend for otherwise
+	}
+
+	unsigned int stolen = 0, late = 0;
+	int index;
+	while (ClaimSubmixJob(pool, generation, &index)) {
+		stolen += TakeSubmixJob(pool, index, JOB(generation, JOB_OPEN));
+	}
+
+	// Everything's handed out by now; whatever no worker has started yet (or can't start) gets
+	// rendered right away, and jobs still being rendered get waited for until the deadline.
+	double start = 0.0, waited = 0.0;
+	bool expired = false;
+	for (;;) {
+		int pending = 0;
+		for (int i = 0; i < jobs; i++) {
+			uint_fast64_t state = atomic_load_explicit(&pool->jobs[i].state, memory_order_acquire);
+			int status = JOB_STATUS(state);
+			if (status == JOB_DONE || status == JOB_TAKEN || (status == JOB_CLAIMED && !expired)) {
+				pending += status == JOB_CLAIMED;
+				continue;
+			}
+			if (TakeSubmixJob(pool, i, state)) {
+				stolen++;
+				late += status == JOB_CLAIMED;
+			} else {
+				pending++; // changed under our hands, so it's looked at again
+			}
+		}
+		if (!pending) {
+			break;
+		}
+		double now = al_get_time();
+		if (!start) {
+			start = now;
+		}
+		waited = now - start;
+		expired = waited >= wait;
+		Relax();
+	}
+
+	BeginSeqlockWrite(&pool->sequence);
+
+	struct SubmixStats* stats = &pool->stats;
+	stats->batches++;
+	stats->jobs += jobs;
+	stats->stolen += stolen;
+	stats->late += late;
+	if (waited > 0.0) {
+		stats->waits++;
+		stats->wait_total += waited;
+		if (waited > stats->wait_max) {
+			stats->wait_max = waited;
+		}
+	}
+
+	EndSeqlockWrite(&pool->sequence);
+}
+
+int GetSubmixLane(struct SubmixPool* pool, int index) {
+	// Which lane holds the job's result; only valid between RunSubmixJobs() and the next batch.
+	int status = JOB_STATUS(atomic_load_explicit(&pool->jobs[index].state, memory_order_acquire));
+	return status == JOB_DONE ? SUBMIX_LANE_WORKER : SUBMIX_LANE_AUDIO;
+}
+
+int GetSubmixThreads(struct Game* game, int jobs) {
+	// By default, there's a worker for every spare core, but never more than there's work to share
+	// with the audio thread, which renders its part as well.
+	int threads = strtol(GetConfigOptionDefault(game, "potatoes", "submix", SUBMIX_DEFAULT), NULL, 10);
+	if (threads < 0) {
+		threads = al_get_cpu_count() - 1;
+	}
+	if (jobs > SUBMIX_JOBS) {
+		return 0;
+	}
+	if (threads > jobs - 1) {
+		threads = jobs - 1;
+	}
+	return threads > 0 ? threads : 0;
+}
+
+void ReadSubmixStats(struct SubmixPool* pool, struct SubmixStats* stats) {
+	unsigned int before;
+	do {
+		before = BeginSeqlockRead(&pool->sequence);
+		memcpy(stats, &pool->stats, sizeof(struct SubmixStats));
+	} while (RetrySeqlockRead(&pool->sequence, before));
+}
+
+void PrintSubmixStats(struct Game* game, struct SubmixPool* pool) {
+	struct SubmixStats stats;
+	ReadSubmixStats(pool, &stats);
+	if (!stats.batches) {
+		return;
+	}
+	PrintConsole(game, "submix: %u batches on %d workers, %.0f%% of the jobs rendered inline, %u late; waited in %u batches, avg %.3f ms, max %.3f ms",
+		stats.batches, pool->count, stats.stolen * 100.0 / stats.jobs, stats.late, stats.waits,
+		stats.waits ? stats.wait_total / stats.waits * 1000.0 : 0.0, stats.wait_max * 1000.0);
+}
@@ -0,0 +1,109 @@
+/*! \file submix.h
+ *  \brief Fork/join pool rendering submixes on worker threads.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_SUBMIX_H
+#define POTATOES_SUBMIX_H
+
+#include <allegro5/allegro.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#define SUBMIX_WINDOW 0.0002 // seconds an idle worker spins on either side of when the next batch is due
+#define SUBMIX_JOBS 0xffff // most jobs in a batch
+#define SUBMIX_WAIT 0.25 // share of the block period the audio thread waits for late workers before redoing their jobs
+
+// Every job has a set of buffers for the workers and one for the audio thread, so a worker
+// that's late can be overtaken without anyone writing into what the other one reads.
+#define SUBMIX_LANE_WORKER 0
+#define SUBMIX_LANE_AUDIO 1
+#define SUBMIX_LANES 2
+
+struct Game;
+
+struct SubmixStats {
+	unsigned int batches;
+	unsigned int jobs;
+	unsigned int stolen; // jobs the audio thread rendered itself because no worker got to them first
+	unsigned int late; // of those, jobs a worker had started but didn't finish in time
+	unsigned int waits; // batches in which the audio thread had to wait for a worker to finish a job
+	double wait_total, wait_max;
+};
+
+struct SubmixJob {
+	atomic_uint_fast64_t state; // generation << 32 | status
+	atomic_int busy; // workers running the job right now, from whichever batch
+};
+
+struct SubmixWorker {
+	struct SubmixPool* pool;
+	ALLEGRO_THREAD* thread;
+	int cpu; // to pin the thread to; -1 for none
+};
+
+/*! \brief Renders the jobs of a batch (e.g. one submix per potato) in parallel.
+ *
+ * The audio thread publishes a batch by bumping a generation counter and then claims jobs
+ * itself, just like the workers do, so a worker that's late (or parked) simply finds nothing
+ * left to do and the audio thread never waits for one to wake up. The only wait left is for jobs
+ * that are already being rendered when the audio thread runs out of jobs to claim, and it's
+ * bounded: past the deadline, the audio thread renders them again in its own lane and the
+ * worker's result gets discarded when it tries to hand it in for a generation that's gone.
+ * A job whose worker is still stuck in it when the next batch comes stays with the audio thread
+ * until the worker is out, and only the one thread that can't be overtaken gets told it may
+ * touch state shared between runs of the job.
+ *
+ * Idle workers sleep until shortly before the next batch is due and spin only around that time;
+ * when it doesn't come, they park until the audio thread wakes them up (with a futex on Linux,
+ * so it doesn't have to take a lock, and a condition variable elsewhere).
+ *
+ * Jobs get claimed with a compare-and-swap on a single word holding the generation, the job
+ * count and the next job, so a worker still looking at a finished batch can't claim anything
+ * from the next one by mistake. Stats are handed to the main thread through a seqlock.
+ */
+struct SubmixPool {
+	void (*job)(void* userdata, int index, int lane, bool owner);
+	void* userdata;
+
+	atomic_uint_fast64_t claim; // generation << 32 | job count << 16 | next job
+	struct SubmixJob* jobs;
+	atomic_bool quit;
+	uint32_t generation; // audio thread only
+
+	atomic_uint wake; // last published generation, for parked workers to wait on
+	atomic_int parked;
+	ALLEGRO_MUTEX* mutex; // without futexes
+	ALLEGRO_COND* cond;
+
+	atomic_uint sequence;
+	struct SubmixStats stats;
+
+	int count;
+	struct SubmixWorker workers[];
+};
+
+struct SubmixPool* CreateSubmixPool(int threads, int jobs, void (*job)(void* userdata, int index, int lane, bool owner), void* userdata);
+void DestroySubmixPool(struct SubmixPool* pool);
+void RunSubmixJobs(struct SubmixPool* pool, int jobs, double wait);
+int GetSubmixLane(struct SubmixPool* pool, int index);
+int GetSubmixThreads(struct Game* game, int jobs);
+void ReadSubmixStats(struct SubmixPool* pool, struct SubmixStats* stats);
+void PrintSubmixStats(struct Game* game, struct SubmixPool* pool);
+
+#endif
@@ -0,0 +1,135 @@
+/*! \file cookbank.c
+ *  \brief Build-time tool cooking the choir loops into a sound bank.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "../loop.h"
+#include "../soundbank.h"
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_acodec.h>
+#include <allegro5/allegro_audio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Usage: cookbank <output> <int16|float32> <pX/Y.flac>...
+// Paths are relative to the data directory; they're stored without extension.
+
+static size_t Align(size_t offset) {
+	return (offset + SOUNDBANK_ALIGNMENT - 1) / SOUNDBANK_ALIGNMENT * SOUNDBANK_ALIGNMENT;
+}
+
+static void ConvertSample(ALLEGRO_SAMPLE* sample, void* dest, ALLEGRO_AUDIO_DEPTH depth) {
+	unsigned int count = LOOP_LENGTH * al_get_channel_count(al_get_sample_channels(sample));
+	int16_t* src = al_get_sample_data(sample);
+	if (depth == ALLEGRO_AUDIO_DEPTH_INT16) {
+		memcpy(dest, src, count * sizeof(int16_t));
+		return;
+	}
+	float* out = dest;
+	for (unsigned int i = 0; i < count; i++) {
+		out[i] = src[i] / 32768.0f;
+	}
+}
+
+int main(int argc, char** argv) {
+	if (argc < 4) {
+		fprintf(stderr, "usage: %s <output> <int16|float32> <files...>\n", argv[0]);
+		return 1;
+	}
+
+	ALLEGRO_AUDIO_DEPTH depth;
+	if (strcmp(argv[2], "int16") == 0) {
+		depth = ALLEGRO_AUDIO_DEPTH_INT16;
+	} else if (strcmp(argv[2], "float32") == 0) {
+		depth = ALLEGRO_AUDIO_DEPTH_FLOAT32;
+	} else {
+		fprintf(stderr, "unknown sample format %s\n", argv[2]);
+		return 1;
+	}
+
+	if (!al_init() || !al_install_audio() || !al_init_acodec_addon()) {
+		fprintf(stderr, "failed to initialize Allegro\n");
+		return 1;
+	}
+
+	unsigned int count = argc - 3;
+	struct SoundBankHeader header = {.magic = SOUNDBANK_MAGIC, .version = SOUNDBANK_VERSION, .count = count,
+		.frequency = LOOP_FREQUENCY, .depth = depth, .channels = ALLEGRO_CHANNEL_CONF_1};
+	struct SoundBankEntry* entries = calloc(count, sizeof(struct SoundBankEntry));
+	size_t frame_size = al_get_audio_depth_size(depth);
+	size_t offset = Align(sizeof(header) + count * sizeof(struct SoundBankEntry));
+
+	for (unsigned int i = 0; i < count; i++) {
+		const char* name = argv[i + 3];
+		size_t len = strcspn(name, ".");
+		if (len >= sizeof(entries[i].name)) {
+			fprintf(stderr, "%s: name too long\n", name);
+			return 1;
+		}
+		memcpy(entries[i].name, name, len);
+		entries[i].offset = offset;
+		entries[i].frames = LOOP_LENGTH;
+		offset = Align(offset + LOOP_LENGTH * frame_size);
+	}
+
+	FILE* out = fopen(argv[1], "wb");
+	if (!out) {
+		perror(argv[1]);
+		return 1;
+	}
+	fwrite(&header, sizeof(header), 1, out);
+	fwrite(entries, sizeof(struct SoundBankEntry), count, out);
+
+	void* buffer = malloc(LOOP_LENGTH * frame_size);
+	bool failed = false;
+	for (unsigned int i = 0; i < count; i++) {
+		const char* name = argv[i + 3];
+		ALLEGRO_SAMPLE* sample = al_load_sample(name);
+		if (!sample) {
+			fprintf(stderr, "%s: could not be loaded\n", name);
+			failed = true;
+			break;
+		}
+		if (al_get_sample_frequency(sample) != LOOP_FREQUENCY || al_get_sample_channels(sample) != ALLEGRO_CHANNEL_CONF_1 ||
+			al_get_sample_depth(sample) != ALLEGRO_AUDIO_DEPTH_INT16) {
+			fprintf(stderr, "%s: expected 16-bit mono at %d Hz\n", name, LOOP_FREQUENCY);
+			failed = true;
+		} else if (al_get_sample_length(sample) < LOOP_LENGTH + LOOP_MARGIN) {
+			fprintf(stderr, "%s: TOO SHORT, length %u, expected at least %d\n", name, al_get_sample_length(sample), LOOP_LENGTH + LOOP_MARGIN);
+			failed = true;
+		}
+		if (failed) {
+			al_destroy_sample(sample);
+			break;
+		}
+
+		ConvertSample(sample, buffer, depth);
+		al_destroy_sample(sample);
+		fseek(out, entries[i].offset, SEEK_SET);
+		fwrite(buffer, frame_size, LOOP_LENGTH, out);
+	}
+
+	free(buffer);
+	free(entries);
+	if (fclose(out) != 0 || failed) {
+		remove(argv[1]);
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,295 @@
+/*! \file trace.c
+ *  \brief Scoped timers recorded into per-thread rings.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "trace.h"
+#include <allegro5/allegro_font.h>
+#include <allegro5/allegro_primitives.h>
+#include <libsuperderpy.h>
+
+atomic_bool trace_enabled = false;
+
+static struct TraceRing* _Atomic rings = NULL; // never freed, reused once their thread is done
+static atomic_int ring_count = 0;
+static _Thread_local struct TraceRing* ring = NULL;
+static _Thread_local bool named = false; // set for threads that live on, like the main one
+
+// Loading steps of the current thread.
+static _Thread_local struct {
+	const char* label;
+	void (*progress)(struct Game*);
+	double last;
+	int step;
+} load;
+
+static struct {
+	bool visible;
+	ALLEGRO_FONT* font;
+	double frames[TRACE_FRAMES];
+	int frame;
+	double last;
+} overlay;
+
+static struct TraceRing* AcquireRing(void) {
+	for (struct TraceRing* r = atomic_load_explicit(&rings, memory_order_acquire); r; r = r->next) {
+		bool used = false;
+		if (atomic_compare_exchange_strong(&r->used, &used, true)) {
+			return r;
+		}
+	}
+
+	struct TraceRing* r = calloc(1, sizeof(struct TraceRing));
+	atomic_init(&r->head, 0);
+	atomic_init(&r->used, true);
+	r->id = atomic_fetch_add(&ring_count, 1) + 1;
+	snprintf(r->name, sizeof(r->name), "thread %d", r->id);
+	r->next = atomic_load_explicit(&rings, memory_order_relaxed);
+	while (!atomic_compare_exchange_weak_explicit(&rings, &r->next, r, memory_order_release, memory_order_relaxed)) {
+	}
+	return r;
+}
+
+void AddTraceEvent(const char* name, const char* detail, double start, double end) {
+	if (!ring) {
+		ring = AcquireRing();
+	}
+	unsigned int head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	struct TraceEvent* event = &ring->events[head % TRACE_RING];
+	event->name = name;
+	event->start = start;
+	event->end = end;
+	event->detail[0] = '\0';
+	if (detail) {
+		// for paths, the end is what tells them apart
+		size_t length = strlen(detail);
+		snprintf(event->detail, TRACE_DETAIL, "%s", length < TRACE_DETAIL ? detail : detail + length - (TRACE_DETAIL - 1));
+	}
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void EndTraceScope(struct TraceScope* scope) {
+	if (scope->start) {
+		AddTraceEvent(scope->name, scope->detail, scope->start, al_get_time());
+	}
+}
+
+void EndTraceLoadScope(struct TraceScope* scope) {
+	EndTraceScope(scope);
+	// Without threads, loading happens on the main thread, which keeps its ring.
+	if (!named) {
+		ReleaseTraceThread();
+	}
+}
+
+void BeginTraceLoad(const char* label) {
+	load.label = label;
+	load.last = al_get_time();
+	load.step = 0;
+}
+
+void TraceLoadStep(void) {
+	// Every step spans the time since the previous one, so together they cover the whole load.
+	double now = al_get_time();
+	load.step++;
+	if (atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+		char detail[TRACE_DETAIL];
+		snprintf(detail, sizeof(detail), "%s %d", load.label, load.step);
+		AddTraceEvent("load step", detail, load.last, now);
+	}
+	load.last = now;
+}
+
+static void TracedProgress(struct Game* game) {
+	TraceLoadStep();
+	load.progress(game);
+}
+
+void (*TraceProgress(const char* label, void (*progress)(struct Game*)))(struct Game*) {
+	BeginTraceLoad(label);
+	load.progress = progress;
+	return TracedProgress;
+}
+
+void EnableTracing(bool enabled) {
+	atomic_store_explicit(&trace_enabled, enabled, memory_order_relaxed);
+}
+
+void SetTraceThreadName(const char* name) {
+	if (!ring) {
+		ring = AcquireRing();
+	}
+	snprintf(ring->name, sizeof(ring->name), "%s", name);
+	named = true;
+}
+
+void ReleaseTraceThread(void) {
+	// Events stay in the ring until another thread takes it over.
+	if (ring) {
+		atomic_store_explicit(&ring->used, false, memory_order_release);
+		ring = NULL;
+	}
+	named = false;
+}
+
+static int ReadRing(struct TraceRing* r, struct TraceEvent* events) {
+	unsigned int head = atomic_load_explicit(&r->head, memory_order_acquire);
+	unsigned int first = head > TRACE_RING ? head - TRACE_RING : 0;
+	for (unsigned int i = first; i < head; i++) {
+		events[i - first] = r->events[i % TRACE_RING];
+	}
+	atomic_thread_fence(memory_order_acquire);
+	// whatever the writer has lapped while we were copying can't be trusted, and neither can the
+	// slot it may be filling right now, as `head` only moves on once it's done
+	unsigned int now = atomic_load_explicit(&r->head, memory_order_relaxed);
+	unsigned int valid = now > TRACE_RING - 1 ? now - TRACE_RING + 1 : 0;
+	if (valid <= first) {
+		return head - first;
+	}
+	if (valid >= head) {
+		return 0;
+	}
+	memmove(events, events + (valid - first), sizeof(struct TraceEvent) * (head - valid));
+	return head - valid;
+}
+
+static void EscapeJSON(char* dest, const char* src) {
+	// paths are the only thing that can need it, mostly for Windows separators
+	for (; *src; src++) {
+		if (*src == '"' || *src == '\\') {
+			*dest++ = '\\';
+		}
+		*dest++ = (unsigned char)*src < 0x20 ? ' ' : *src;
+	}
+	*dest = '\0';
+}
+
+bool DumpTrace(const char* path) {
+	FILE* file = fopen(path, "w");
+	if (!file) {
+		return false;
+	}
+	struct TraceEvent* events = malloc(sizeof(struct TraceEvent) * TRACE_RING);
+	bool first = true;
+	char detail[TRACE_DETAIL * 2];
+	fprintf(file, "{\"traceEvents\":[");
+	for (struct TraceRing* r = atomic_load_explicit(&rings, memory_order_acquire); r; r = r->next) {
+		fprintf(file, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", first ? "" : ",", r->id, r->name);
+		first = false;
+		int count = ReadRing(r, events);
+		for (int i = 0; i < count; i++) {
+			fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", events[i].name, r->id,
+				events[i].start * 1000000.0, (events[i].end - events[i].start) * 1000000.0);
+			if (events[i].detail[0]) {
+				EscapeJSON(detail, events[i].detail);
+				fprintf(file, ",\"args\":{\"detail\":\"%s\"}", detail);
+			}
+			fprintf(file, "}");
+		}
+	}
+	fprintf(file, "\n]}\n");
+	free(events);
+	return fclose(file) == 0;
+}
+
+void ToggleTraceOverlay(void) {
+	overlay.visible = !overlay.visible;
+	if (overlay.visible) {
+		EnableTracing(true);
+	}
+}
+
+void DrawTraceOverlay(struct Game* game) {
+	double now = al_get_time();
+	if (overlay.last) {
+		overlay.frames[overlay.frame] = now - overlay.last;
+		overlay.frame = (overlay.frame + 1) % TRACE_FRAMES;
+	}
+	overlay.last = now;
+
+	if (!overlay.visible) {
+		return;
+	}
+	if (!overlay.font) {
+		overlay.font = al_create_builtin_font();
+	}
+
+	// Every scope that ended within the last second, summed up per name.
+	struct {
+		const char* name;
+		int count;
+		double total, max;
+	} stats[TRACE_NAMES];
+	int names = 0;
+	struct TraceEvent* events = malloc(sizeof(struct TraceEvent) * TRACE_RING);
+	for (struct TraceRing* r = atomic_load_explicit(&rings, memory_order_acquire); r; r = r->next) {
+		int count = ReadRing(r, events);
+		for (int i = count - 1; i >= 0 && events[i].end > now - 1.0; i--) {
+			int j = 0;
+			while (j < names && strcmp(stats[j].name, events[i].name) != 0) {
+				j++;
+			}
+			if (j == names) {
+				if (names == TRACE_NAMES) {
+					continue;
+				}
+				stats[names++] = (typeof(stats[0])){.name = events[i].name};
+			}
+			double duration = events[i].end - events[i].start;
+			stats[j].count++;
+			stats[j].total += duration;
+			if (duration > stats[j].max) {
+				stats[j].max = duration;
+			}
+		}
+	}
+	free(events);
+
+	ALLEGRO_TRANSFORM transform, orig = *al_get_current_transform();
+	al_identity_transform(&transform);
+	al_scale_transform(&transform, 2, 2);
+	al_use_transform(&transform);
+
+	int height = al_get_font_line_height(overlay.font) + 2;
+	al_draw_filled_rectangle(0, 0, 352, (names + 1) * height + 70, al_map_rgba(0, 0, 0, 192));
+	al_draw_text(overlay.font, al_map_rgb(255, 255, 0), 4, 4, ALLEGRO_ALIGN_LEFT, "scope                n/s    avg    max ms");
+	for (int i = 0; i < names; i++) {
+		al_draw_textf(overlay.font, al_map_rgb(255, 255, 255), 4, 4 + (i + 1) * height, ALLEGRO_ALIGN_LEFT, "%-20.20s %4d %6.2f %6.2f",
+			stats[i].name, stats[i].count, stats[i].total / stats[i].count * 1000.0, stats[i].max * 1000.0);
+	}
+
+	// Frame times, with lines at 60 and 30 FPS.
+	float base = (names + 1) * height + 66;
+	for (int i = 0; i < TRACE_FRAMES; i++) {
+		double frame = overlay.frames[(overlay.frame + i) % TRACE_FRAMES];
+		float bar = fmin(frame * 1000.0, 60.0);
+		al_draw_line(4 + i + 0.5, base, 4 + i + 0.5, base - bar, frame > 1 / 30.0 ? al_map_rgb(255, 0, 0) : al_map_rgb(0, 255, 0), 1);
+	}
+	al_draw_line(4, base - 1000 / 60.0, 4 + TRACE_FRAMES, base - 1000 / 60.0, al_map_rgba(255, 255, 255, 128), 1);
+	al_draw_line(4, base - 1000 / 30.0, 4 + TRACE_FRAMES, base - 1000 / 30.0, al_map_rgba(255, 255, 255, 128), 1);
+
+	al_use_transform(&orig);
+}
+
+void DestroyTraceOverlay(void) {
+	if (overlay.font) {
+		al_destroy_font(overlay.font);
+		overlay.font = NULL;
+	}
+}
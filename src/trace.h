@@ -0,0 +1,100 @@
+/*! \file trace.h
+ *  \brief Scoped timers recorded into per-thread rings.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_TRACE_H
+#define POTATOES_TRACE_H
+
+#include <allegro5/allegro.h>
+#include <stdatomic.h>
+
+#define TRACE_RING 4096 // events kept per thread
+#define TRACE_NAMES 32 // distinct scopes shown by the overlay
+#define TRACE_FRAMES 240 // frame times plotted by the overlay
+#define TRACE_DETAIL 48 // longest detail kept with an event, e.g. a file name
+
+struct Game;
+
+struct TraceEvent {
+	const char* name; // has to outlive the trace, so usually a string literal
+	char detail[TRACE_DETAIL]; // copied, so it can come from anywhere; ends with the tail of longer ones
+	double start, end;
+};
+
+/*! \brief Events recorded by a single thread.
+ *
+ * Only the owning thread writes; readers copy the events below `head` and drop the ones
+ * that could have been overwritten in the meantime.
+ */
+struct TraceRing {
+	struct TraceEvent events[TRACE_RING];
+	atomic_uint head;
+	atomic_bool used; // owned by a thread
+	int id;
+	char name[32];
+	struct TraceRing* next;
+};
+
+struct TraceScope {
+	const char* name;
+	const char* detail; // has to stay valid until the end of the scope
+	double start; // 0 when tracing was disabled at the beginning of the scope
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+/*! \brief Times the rest of the enclosing block. Costs a single relaxed load while tracing is disabled. */
+#define TRACE_SCOPE(name) TRACE_SCOPE_DETAIL(name, NULL)
+#define TRACE_SCOPE_DETAIL(name, detail) \
+	struct TraceScope TRACE_CONCAT(trace_scope_, __LINE__) __attribute__((cleanup(EndTraceScope))) = BeginTraceScope(name, detail)
+
+/*! \brief Times a gamestate's Load. Loading threads don't outlive it, so their ring gets released at the end. */
+#define TRACE_LOAD_SCOPE(name) \
+	struct TraceScope TRACE_CONCAT(trace_scope_, __LINE__) __attribute__((cleanup(EndTraceLoadScope))) = BeginTraceScope(name, NULL)
+
+/*! \brief Calls a loading function with the path as its first argument, timed under the function's name. */
+#define TRACE_LOAD(func, path, ...) ({ \
+	const char* trace_path = (path); \
+	TRACE_SCOPE_DETAIL(#func, trace_path); \
+	func(trace_path, ##__VA_ARGS__); \
+})
+
+extern atomic_bool trace_enabled;
+
+static inline struct TraceScope BeginTraceScope(const char* name, const char* detail) {
+	return (struct TraceScope){.name = name, .detail = detail, .start = atomic_load_explicit(&trace_enabled, memory_order_relaxed) ? al_get_time() : 0.0};
+}
+
+void EndTraceScope(struct TraceScope* scope);
+void EndTraceLoadScope(struct TraceScope* scope);
+void AddTraceEvent(const char* name, const char* detail, double start, double end);
+void BeginTraceLoad(const char* label);
+void TraceLoadStep(void);
+void (*TraceProgress(const char* label, void (*progress)(struct Game*)))(struct Game*);
+void EnableTracing(bool enabled);
+void SetTraceThreadName(const char* name);
+void ReleaseTraceThread(void);
+bool DumpTrace(const char* path);
+
+void ToggleTraceOverlay(void);
+void DrawTraceOverlay(struct Game* game);
+void DestroyTraceOverlay(void);
+
+#endif
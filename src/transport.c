@@ -0,0 +1,155 @@
+/*! \file transport.c
+ *  \brief Shared transport clock for the choir loops.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "common.h"
+#include "transport.h"
+#include "deadline.h"
+#include "sendbus.h"
+#include "seqlock.h"
+#include <libsuperderpy.h>
+
+static void TransportPostprocess(void* buffer, unsigned int samples, void* userdata) {
+	struct Transport* transport = userdata;
+	struct DeadlineMonitor* monitor = atomic_load_explicit(&transport->monitor, memory_order_acquire);
+
+	// Every potato has been mixed and has sent its share by now.
+	struct SendBus* bus = atomic_load_explicit(&transport->bus, memory_order_acquire);
+	if (bus) {
+		double start = al_get_time();
+		ProcessSendBus(bus, buffer, samples);
+		if (monitor) {
+			AddDeadlineStage(monitor, bus->stage, al_get_time() - start);
+		}
+	}
+
+	BeginSeqlockWrite(&transport->sequence);
+
+	transport->time = al_get_time();
+	atomic_store_explicit(&transport->block, samples, memory_order_relaxed);
+	atomic_fetch_add_explicit(&transport->frames, samples, memory_order_release);
+
+	EndSeqlockWrite(&transport->sequence);
+
+	if (monitor) {
+		EndDeadlineBlock(monitor, samples);
+	}
+}
+
+static unsigned int LoopPosition(struct Transport* transport, uint64_t frames) {
+	// Allegro steps sample instances with an exact rational ratio, so integer math keeps us in lockstep.
+	uint64_t elapsed = frames - transport->origin;
+	return (elapsed * transport->frequency / al_get_mixer_frequency(transport->mixer)) % transport->length;
+}
+
+struct Transport* CreateTransport(struct Game* game, ALLEGRO_MIXER* parent, unsigned int length, unsigned int frequency, unsigned int beats, unsigned int bar) {
+	struct Transport* transport = calloc(1, sizeof(struct Transport));
+	atomic_init(&transport->frames, 0);
+	atomic_init(&transport->block, 0);
+	atomic_init(&transport->sequence, 0);
+	atomic_init(&transport->monitor, NULL);
+	atomic_init(&transport->bus, NULL);
+	transport->length = length;
+	transport->frequency = frequency;
+	transport->beats = beats;
+	transport->bar = bar;
+	transport->mixer = al_create_mixer(al_get_mixer_frequency(parent), ALLEGRO_AUDIO_DEPTH_FLOAT32, ALLEGRO_CHANNEL_CONF_2);
+	al_set_mixer_postprocess_callback(transport->mixer, TransportPostprocess, transport);
+	al_attach_mixer_to_mixer(transport->mixer, parent);
+
+	// Allegro doesn't tell how much audio is queued in the voice, so it can be set by hand (in ms).
+	transport->latency = strtol(GetConfigOptionDefault(game, "potatoes", "latency", "0"), NULL, 10) * al_get_mixer_frequency(transport->mixer) / 1000;
+	return transport;
+}
+
+void DestroyTransport(struct Game* game, struct Transport* transport) {
+	al_destroy_mixer(transport->mixer);
+	free(transport);
+}
+
+void ResetTransport(struct Transport* transport) {
+	transport->origin = atomic_load_explicit(&transport->frames, memory_order_acquire);
+}
+
+void SetTransportMonitor(struct Transport* transport, struct DeadlineMonitor* monitor) {
+	atomic_store_explicit(&transport->monitor, monitor, memory_order_release);
+}
+
+void SetTransportBus(struct Transport* transport, struct SendBus* bus) {
+	atomic_store_explicit(&transport->bus, bus, memory_order_release);
+}
+
+double GetTransportPlaybackPosition(struct Transport* transport) {
+	unsigned int before, block;
+	uint64_t frames;
+	double time;
+	do {
+		before = BeginSeqlockRead(&transport->sequence);
+		frames = atomic_load_explicit(&transport->frames, memory_order_relaxed);
+		block = atomic_load_explicit(&transport->block, memory_order_relaxed);
+		time = transport->time;
+	} while (RetrySeqlockRead(&transport->sequence, before));
+
+	double rate = al_get_mixer_frequency(transport->mixer);
+	double latency = transport->latency ? transport->latency : block * 2.0; // assume double buffering
+
+	// Between callbacks, the clock runs on the wall time, but never ahead of what has already been mixed.
+	double elapsed = (al_get_time() - time) * rate;
+	if (elapsed > block) {
+		elapsed = block;
+	}
+
+	double played = frames - latency + elapsed;
+	if (played < transport->played) {
+		played = transport->played;
+	}
+	transport->played = played;
+
+	double position = fmod((played - transport->origin) * transport->frequency / rate, transport->length);
+	if (position < 0) {
+		position += transport->length;
+	}
+	return position;
+}
+
+double GetTransportBeat(struct Transport* transport) {
+	return GetTransportPlaybackPosition(transport) / transport->length * transport->beats;
+}
+
+double GetTransportBar(struct Transport* transport) {
+	return GetTransportBeat(transport) / transport->bar;
+}
+
+void SyncSampleInstance(struct Transport* transport, ALLEGRO_SAMPLE_INSTANCE* instance) {
+	// The clock advances on the audio thread, so retry until no buffer got mixed
+	// between reading it and moving the instance.
+	uint64_t frames;
+	do {
+		frames = atomic_load_explicit(&transport->frames, memory_order_acquire);
+		al_set_sample_instance_position(instance, LoopPosition(transport, frames));
+	} while (atomic_load_explicit(&transport->frames, memory_order_acquire) != frames);
+}
+
+void SyncAudioStream(struct Transport* transport, ALLEGRO_AUDIO_STREAM* stream) {
+	// Streams are fed lazily: the buffer in which a freshly attached stream gets mixed for the first time
+	// only wakes up its feeder thread, so its audio starts one buffer later.
+	uint64_t frames = atomic_load_explicit(&transport->frames, memory_order_acquire);
+	frames += atomic_load_explicit(&transport->block, memory_order_relaxed);
+	al_seek_audio_stream_secs(stream, LoopPosition(transport, frames) / (double)transport->frequency);
+}
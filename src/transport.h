@@ -0,0 +1,72 @@
+/*! \file transport.h
+ *  \brief Shared transport clock for the choir loops.
+ */
+/*
+ * Copyright (c) Sebastian Krzyszkowiak <dos@dosowisko.net>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef POTATOES_TRANSPORT_H
+#define POTATOES_TRANSPORT_H
+
+#include <allegro5/allegro.h>
+#include <allegro5/allegro_audio.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+struct Game;
+struct DeadlineMonitor;
+struct SendBus;
+
+/*! \brief Clock that all the choir loops are (virtually) playing against.
+ *
+ * The transport owns a mixer that sits between the per-potato mixers and the music mixer.
+ * Its postprocess callback runs after all of its inputs have been mixed, so while the audio
+ * thread is mixing a buffer, `frames` holds the position at which that buffer starts.
+ *
+ * For visuals, the playback position is extrapolated from the time of the last callback and
+ * delayed by the output latency, so it follows what's actually being heard.
+ */
+struct Transport {
+	ALLEGRO_MIXER* mixer;
+	atomic_uint_fast64_t frames; // frames mixed since the transport has been created
+	atomic_uint block; // size of the last mixed buffer, in frames
+	atomic_uint sequence; // seqlock guarding `time` together with `frames`
+	double time; // al_get_time() of the last callback
+	uint64_t origin; // value of `frames` at which the loops are considered to start
+	unsigned int length; // loop length, in frames of the loops' sample rate
+	unsigned int frequency; // sample rate of the loops
+	unsigned int beats; // beats per loop
+	unsigned int bar; // beats per bar
+
+	unsigned int latency; // output latency in mixer frames; 0 to estimate it from the buffer size
+	double played; // last reported playback position, keeps it monotonic
+
+	struct DeadlineMonitor* _Atomic monitor; // optional, told whenever a block has been mixed
+	struct SendBus* _Atomic bus; // optional, processed on top of every mixed block
+};
+
+struct Transport* CreateTransport(struct Game* game, ALLEGRO_MIXER* parent, unsigned int length, unsigned int frequency, unsigned int beats, unsigned int bar);
+void DestroyTransport(struct Game* game, struct Transport* transport);
+void ResetTransport(struct Transport* transport);
+void SetTransportMonitor(struct Transport* transport, struct DeadlineMonitor* monitor);
+void SetTransportBus(struct Transport* transport, struct SendBus* bus);
+double GetTransportPlaybackPosition(struct Transport* transport);
+double GetTransportBeat(struct Transport* transport);
+double GetTransportBar(struct Transport* transport);
+void SyncSampleInstance(struct Transport* transport, ALLEGRO_SAMPLE_INSTANCE* instance);
+void SyncAudioStream(struct Transport* transport, ALLEGRO_AUDIO_STREAM* stream);
+
+#endif